@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "matrix.h"
+#include "batch.h"
+#include "util.h"
+
+/*
+ * Task queue of one worker. The owner takes from the head, idle workers
+ * steal from the tail, so both ends are only contended on the last task.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	unsigned int* tasks; // Item indices, most expensive first
+	unsigned int head;
+	unsigned int tail;
+}Batch_Deque_t;
+
+typedef struct {
+	Batch_Deque_t* deques;
+	unsigned int num_workers;
+	Batch_Item_t* items;
+	Batch_Kernel_t kernel;
+	const void* arg;
+}Batch_Pool_t;
+
+typedef struct {
+	Batch_Pool_t* pool;
+	unsigned int id;
+}Batch_Worker_t;
+
+/*protected functions*/
+static void* run_worker (void* arg);
+static bool take_task (Batch_Deque_t* deque, bool steal, unsigned int* task);
+static int compare_cost (const void* a, const void* b);
+static bool has_namesake (Matrix_t** matches, unsigned int num_matches, unsigned int index);
+
+/*
+ * PURPOSE: Run a kernel over every matched matrix. The matrices are dealt out
+ *	most expensive first over per worker queues and workers that run dry steal
+ *	from the others, so one large matrix does not hold up the small ones.
+ *	Matrices sharing a buffer through views, and matrices sharing a name (and
+ *	so the file named after it), are run one after another on the calling
+ *	thread so no two kernels touch the same elements or file at once.
+ * INPUTS:
+ *	matches : Array of Matrix_t pointers to run the kernel on
+ *	num_matches : Number of matrices in matches
+ *	kernel : Function run once per matrix, its result goes into the item
+ *	arg : Pointer passed to every kernel call
+ *	items : Pointer to store the Batch_Item_t array in, in the order of matches
+ * RETURN: True if the batch ran, false if it could not be set up
+ **/
+bool run_batch (Matrix_t** matches, unsigned int num_matches, Batch_Kernel_t kernel,
+			const void* arg, Batch_Item_t** items) {
+	// Check parameters
+	if (!matches || num_matches == 0 || !kernel || !items) {
+		return false;
+	}
+
+	*items = calloc(num_matches, sizeof(Batch_Item_t));
+	Batch_Item_t** order = calloc(num_matches, sizeof(Batch_Item_t*));
+	unsigned int* dealt = calloc(num_matches, sizeof(unsigned int));
+	if (!(*items) || !order || !dealt) {
+		free(*items);
+		free(order);
+		free(dealt);
+		*items = NULL;
+		return false;
+	}
+
+	unsigned int num_parallel = 0;
+	for (unsigned int i = 0; i < num_matches; ++i) {
+		Batch_Item_t* item = &(*items)[i];
+		item->mat = matches[i];
+		item->cost = (size_t) matches[i]->rows * matches[i]->cols;
+		item->serial = matches[i]->parent || matches[i]->views || has_namesake(matches, num_matches, i);
+		if (!item->serial) {
+			order[num_parallel++] = item;
+		}
+	}
+	qsort(order, num_parallel, sizeof(Batch_Item_t*), compare_cost);
+
+	const unsigned int num_workers = num_parallel ? count_threads(num_parallel, 1, BATCH_MAX_WORKERS) : 0;
+
+	if (num_workers > 0) {
+		Batch_Deque_t deques[BATCH_MAX_WORKERS];
+		Batch_Worker_t workers[BATCH_MAX_WORKERS];
+		Batch_Pool_t pool = {deques, num_workers, *items, kernel, arg};
+
+		// Deal the sorted tasks round robin so every queue starts with similar work
+		unsigned int next = 0;
+		for (unsigned int w = 0; w < num_workers; ++w) {
+			pthread_mutex_init(&deques[w].lock, NULL);
+			deques[w].tasks = &dealt[next];
+			deques[w].head = 0;
+			deques[w].tail = 0;
+			for (unsigned int t = w; t < num_parallel; t += num_workers) {
+				dealt[next++] = order[t] - *items;
+				deques[w].tail++;
+			}
+		}
+
+		// The calling thread is worker zero
+		for (unsigned int w = 0; w < num_workers; ++w) {
+			workers[w].pool = &pool;
+			workers[w].id = w;
+		}
+		run_parallel(workers, sizeof(Batch_Worker_t), num_workers, run_worker);
+		for (unsigned int w = 0; w < num_workers; ++w) {
+			pthread_mutex_destroy(&deques[w].lock);
+		}
+	}
+
+	for (unsigned int i = 0; i < num_matches; ++i) {
+		Batch_Item_t* item = &(*items)[i];
+		if (item->serial) {
+			item->success = kernel(item, arg);
+		}
+	}
+	free(order);
+	free(dealt);
+	return true;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Work through the own queue, then steal from the others until
+ *	every queue is empty. Tasks never create tasks, so empty queues stay empty.
+ * INPUTS:
+ *	arg : Pointer to Batch_Worker_t of this worker
+ * RETURN: NULL
+ **/
+static void* run_worker (void* arg) {
+	Batch_Worker_t* worker = arg;
+	Batch_Pool_t* pool = worker->pool;
+	for (;;) {
+		unsigned int task = 0;
+		bool found = take_task(&pool->deques[worker->id], false, &task);
+		for (unsigned int k = 1; !found && k < pool->num_workers; ++k) {
+			found = take_task(&pool->deques[(worker->id + k) % pool->num_workers], true, &task);
+		}
+		if (!found) {
+			break;
+		}
+		Batch_Item_t* item = &pool->items[task];
+		item->success = pool->kernel(item, pool->arg);
+	}
+	return NULL;
+}
+
+/*
+ * PURPOSE: Take one task from a queue
+ * INPUTS:
+ *	deque : Pointer to Batch_Deque_t to take from
+ *	steal : True to take from the tail as a thief, false to take from the head
+ *	task : Pointer to store the item index in
+ * RETURN: True if a task was taken, false if the queue is empty
+ **/
+static bool take_task (Batch_Deque_t* deque, bool steal, unsigned int* task) {
+	pthread_mutex_lock(&deque->lock);
+	const bool found = deque->head < deque->tail;
+	if (found) {
+		*task = steal ? deque->tasks[--deque->tail] : deque->tasks[deque->head++];
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+/*
+ * PURPOSE: qsort comparison ordering Batch_Item_t pointers by descending cost
+ * INPUTS:
+ *	a : Pointer to first Batch_Item_t pointer
+ *	b : Pointer to second Batch_Item_t pointer
+ * RETURN: Negative if a costs more than b, positive if less, else 0
+ **/
+static int compare_cost (const void* a, const void* b) {
+	const size_t cost_a = (*(Batch_Item_t* const*) a)->cost;
+	const size_t cost_b = (*(Batch_Item_t* const*) b)->cost;
+	return (cost_a < cost_b) - (cost_a > cost_b);
+}
+
+/*
+ * PURPOSE: Check whether another matched matrix has the same name
+ * INPUTS:
+ *	matches : Array of Matrix_t pointers of the batch
+ *	num_matches : Number of matrices in matches
+ *	index : Index in matches of the matrix to check
+ * RETURN: True if some other match shares its name, else false
+ **/
+static bool has_namesake (Matrix_t** matches, unsigned int num_matches, unsigned int index) {
+	for (unsigned int i = 0; i < num_matches; ++i) {
+		if (i != index && strncmp(matches[i]->name, matches[index]->name, MATRIX_NAME_LEN) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
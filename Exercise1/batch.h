@@ -0,0 +1,20 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#define BATCH_MAX_WORKERS 16
+
+/* One matrix of a batch command and what the command made of it */
+typedef struct {
+	Matrix_t* mat;
+	size_t cost; // Elements to touch, larger items are scheduled first
+	bool serial; // Shares its buffer through views, run on the calling thread only
+	bool success;
+	unsigned int value; // Command specific result, such as a sum
+}Batch_Item_t;
+
+typedef bool (*Batch_Kernel_t)(Batch_Item_t* item, const void* arg);
+
+bool run_batch (Matrix_t** matches, unsigned int num_matches, Batch_Kernel_t kernel,
+			const void* arg, Batch_Item_t** items);
+
+#endif
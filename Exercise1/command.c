@@ -1,13 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fnmatch.h>
 
 #include "command.h"
 
 #define MAX_CMD_COUNT 50
-#define MAX_CMD_LEN 25
+#define COMMAND_TABLE_SIZE 64
+#define PLAN_CACHE_SIZE 64
 
+/* Slot of the compiled plan cache, keyed by the raw input line */
+typedef struct {
+	char* line;
+	uint32_t hash;
+	Command_Plan_t* plan;
+}Plan_Cache_Entry_t;
+
+static const Command_Def_t* command_table[COMMAND_TABLE_SIZE];
+static uint32_t command_table_seed = 0;
+static Plan_Cache_Entry_t plan_cache[PLAN_CACHE_SIZE];
+static Command_Journal_t command_journal = NULL;
+
+/*protected functions*/
+static uint32_t hash_string (const char* str, uint32_t seed);
+static bool parse_argument (Command_Arg_t* arg, Arg_Type_t type, const char* text);
+static void run_plan (Command_Plan_t* plan, const char* line, Matrix_t** mats, unsigned int num_mats);
 
 /*
  * PURPOSE: Parse the supplied string and store in in cmd structure provided
@@ -24,20 +44,33 @@ bool parse_user_input (const char* input, Commands_t** cmd) {
 	}
 
 	char *string = strdup(input);
-	
+	if (!string) {
+		return false;
+	}
+
 	*cmd = calloc (1,sizeof(Commands_t));
+	if (!(*cmd)) {
+		free(string);
+		return false;
+	}
 	(*cmd)->cmds = calloc(MAX_CMD_COUNT,sizeof(char*));
+	if (!(*cmd)->cmds) {
+		free(string);
+		destroy_commands(cmd);
+		return false;
+	}
 
 	unsigned int i = 0;
 	char *token;
 	token = strtok(string, " \n");
 	for (; token != NULL && i < MAX_CMD_COUNT; ++i) {
-		(*cmd)->cmds[i] = calloc(MAX_CMD_LEN,sizeof(char));
+		(*cmd)->cmds[i] = strdup(token);
 		if (!(*cmd)->cmds[i]) {
 			perror("Allocation Error\n");
+			free(string);
+			destroy_commands(cmd);
 			return false;
-		}	
-		strncpy((*cmd)->cmds[i],token, strlen(token) + 1);
+		}
 		(*cmd)->num_cmds++;
 		token = strtok(NULL, " \n");
 	}
@@ -57,7 +90,7 @@ void destroy_commands(Commands_t** cmd) {
 	if(!cmd || !(*cmd)) {
 		return;
 	}
-	
+
 	for (int i = 0; i < (*cmd)->num_cmds; ++i) {
 		free((*cmd)->cmds[i]);
 	}
@@ -66,3 +99,361 @@ void destroy_commands(Commands_t** cmd) {
 	*cmd = NULL;
 }
 
+/*
+ * PURPOSE: Build a collision free hash table over the command definitions by
+ *	searching for a seed that gives every command name its own slot
+ * INPUTS:
+ *	defs : Array of Command_Def_t to index, must outlive the table
+ *	num_defs : Number of definitions in defs
+ * RETURN: True if a perfect seed was found, else false
+ **/
+bool init_command_table (const Command_Def_t* defs, unsigned int num_defs) {
+	// Check parameters
+	if (!defs || num_defs == 0 || num_defs > COMMAND_TABLE_SIZE) {
+		return false;
+	}
+
+	for (uint32_t seed = 1; seed < 100000; ++seed) {
+		memset(command_table, 0, sizeof(command_table));
+		bool collision = false;
+		for (unsigned int i = 0; i < num_defs && !collision; ++i) {
+			const uint32_t slot = hash_string(defs[i].name, seed) % COMMAND_TABLE_SIZE;
+			if (command_table[slot]) {
+				collision = true;
+			}
+			command_table[slot] = &defs[i];
+		}
+		if (!collision) {
+			command_table_seed = seed;
+			return true;
+		}
+	}
+	memset(command_table, 0, sizeof(command_table));
+	return false;
+}
+
+/*
+ * PURPOSE: Find a command definition by name with a single probe of the table
+ * INPUTS:
+ *	name : Command name to look up
+ * RETURN: Pointer to the Command_Def_t, else NULL if no such command
+ **/
+const Command_Def_t* lookup_command (const char* name) {
+	// Check parameter
+	if (!name || !command_table_seed) {
+		return NULL;
+	}
+
+	const Command_Def_t* def = command_table[hash_string(name, command_table_seed) % COMMAND_TABLE_SIZE];
+	if (def && strcmp(def->name, name) == 0) {
+		return def;
+	}
+	return NULL;
+}
+
+/*
+ * PURPOSE: Check a parsed command against its definition and convert it into a plan
+ * INPUTS:
+ *	cmd : Pointer to Commands_t holding the parsed input
+ *	mats : Pointer to Matrix_t array to resolve matrix arguments in
+ *	num_mats : Number of matrices in mats array
+ *	plan : Pointer to Command_Plan_t* to store the compiled plan in
+ * RETURN: True if the command is valid and every argument resolved, else false
+ **/
+bool compile_command_plan (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats, Command_Plan_t** plan) {
+	// Check parameters
+	if (!cmd || !mats || !plan || cmd->num_cmds == 0) {
+		return false;
+	}
+
+	const Command_Def_t* def = lookup_command(cmd->cmds[0]);
+	if (!def) {
+		printf("Not a command in this application\n");
+		return false;
+	}
+
+	const unsigned int num_args = cmd->num_cmds - 1;
+	if (num_args < def->min_args || num_args > def->max_args) {
+		printf("Wrong number of arguments for %s\n", def->name);
+		return false;
+	}
+
+	*plan = calloc(1, sizeof(Command_Plan_t));
+	if (!(*plan)) {
+		return false;
+	}
+	(*plan)->def = def;
+	bool pattern_seen = false;
+	for (unsigned int i = 0; i < num_args; ++i) {
+		if (!parse_argument(&(*plan)->args[i], def->arg_types[i], cmd->cmds[i + 1])) {
+			destroy_command_plan(plan);
+			return false;
+		}
+		(*plan)->num_args++;
+
+		// Only the first matrix argument of a batch command may be a pattern
+		if (def->arg_types[i] == ARG_MATRIX && strpbrk(cmd->cmds[i + 1], NAME_PATTERN_CHARS)) {
+			if (!def->batch || pattern_seen) {
+				printf("%s does not take a name pattern here (%s)\n", def->name, cmd->cmds[i + 1]);
+				destroy_command_plan(plan);
+				return false;
+			}
+			(*plan)->matches = calloc(num_mats, sizeof(Matrix_t*));
+			if (!(*plan)->matches) {
+				destroy_command_plan(plan);
+				return false;
+			}
+		}
+		if (def->arg_types[i] == ARG_MATRIX) {
+			pattern_seen = true;
+		}
+	}
+
+	if (!resolve_command_plan(*plan, mats, num_mats)) {
+		destroy_command_plan(plan);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Look up the matrices named by a plan, skipped when the matrix array
+ *	has not changed since the plan was last resolved
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t to resolve
+ *	mats : Pointer to Matrix_t array to resolve matrix arguments in
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if every matrix argument exists, else false
+ **/
+bool resolve_command_plan (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	// Check parameters
+	if (!plan || !mats) {
+		return false;
+	}
+
+	const unsigned long generation = matrix_array_generation();
+	if (plan->generation == generation) {
+		return true;
+	}
+
+	for (unsigned int i = 0; i < plan->num_args; ++i) {
+		if (plan->def->arg_types[i] != ARG_MATRIX) {
+			continue;
+		}
+		if (plan->matches && strpbrk(plan->args[i].text, NAME_PATTERN_CHARS)) {
+			plan->num_matches = 0;
+			for (unsigned int j = 0; j < num_mats; ++j) {
+				if (mats[j] && fnmatch(plan->args[i].text, mats[j]->name, 0) == 0) {
+					plan->matches[plan->num_matches++] = mats[j];
+				}
+			}
+			if (plan->num_matches == 0) {
+				printf("No matrix matches (%s)\n", plan->args[i].text);
+				plan->generation = 0;
+				return false;
+			}
+			plan->args[i].mat = NULL;
+			continue;
+		}
+		const int idx = find_matrix_given_name(mats, num_mats, plan->args[i].text);
+		if (idx < 0) {
+			printf("Matrix (%s) doesn't exist\n", plan->args[i].text);
+			plan->generation = 0;
+			return false;
+		}
+		plan->args[i].mat = mats[idx];
+	}
+	plan->generation = generation;
+	return true;
+}
+
+/*
+ * PURPOSE: Free the memory used by a compiled plan
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t* to free
+ * RETURN: NONE
+ **/
+void destroy_command_plan (Command_Plan_t** plan) {
+	// Check parameter
+	if (!plan || !(*plan)) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < MAX_CMD_ARGS; ++i) {
+		free((*plan)->args[i].text);
+	}
+	free((*plan)->matches);
+	free((*plan)->journal_line);
+	free(*plan);
+	*plan = NULL;
+}
+
+/*
+ * PURPOSE: Run one line of user input. Lines seen before reuse their compiled
+ *	plan and skip tokenizing, command lookup and argument parsing.
+ * INPUTS:
+ *	line : user command line input
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if a command was run, else false
+ **/
+bool run_command_line (const char* line, Matrix_t** mats, unsigned int num_mats) {
+	// Check parameters
+	if (!line || !mats) {
+		return false;
+	}
+
+	const uint32_t hash = hash_string(line, 0);
+	Plan_Cache_Entry_t* entry = &plan_cache[hash % PLAN_CACHE_SIZE];
+	if (entry->plan && entry->hash == hash && strcmp(entry->line, line) == 0) {
+		if (!resolve_command_plan(entry->plan, mats, num_mats)) {
+			return false;
+		}
+		run_plan(entry->plan, line, mats, num_mats);
+		return true;
+	}
+
+	Commands_t* cmd = NULL;
+	if (!parse_user_input(line, &cmd)) {
+		printf("Failed at parsing command\n\n");
+		return false;
+	}
+	if (cmd->num_cmds == 0) {
+		destroy_commands(&cmd);
+		return false;
+	}
+
+	Command_Plan_t* plan = NULL;
+	const bool compiled = compile_command_plan(cmd, mats, num_mats, &plan);
+	destroy_commands(&cmd);
+	if (!compiled) {
+		return false;
+	}
+
+	char* line_copy = strdup(line);
+	if (line_copy) {
+		// Replace whatever plan was cached in this slot
+		free(entry->line);
+		destroy_command_plan(&entry->plan);
+		entry->line = line_copy;
+		entry->hash = hash;
+		entry->plan = plan;
+	}
+
+	run_plan(plan, line, mats, num_mats);
+
+	if (!line_copy) {
+		destroy_command_plan(&plan);
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Free every plan held in the compiled plan cache
+ * INPUTS: NONE
+ * RETURN: NONE
+ **/
+void destroy_command_cache (void) {
+	for (unsigned int i = 0; i < PLAN_CACHE_SIZE; ++i) {
+		free(plan_cache[i].line);
+		destroy_command_plan(&plan_cache[i].plan);
+		plan_cache[i].line = NULL;
+	}
+}
+
+/*
+ * PURPOSE: Set the function every journaled command is passed to after it ran
+ * INPUTS:
+ *	journal : Function taking the line to journal, NULL to stop journaling
+ * RETURN: NONE
+ **/
+void set_command_journal (Command_Journal_t journal) {
+	command_journal = journal;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Run the handler of a plan and hand the line to the journal if the
+ *	command succeeded; a failed command may fail differently on replay
+ * INPUTS:
+ *	plan : Pointer to resolved Command_Plan_t to run
+ *	line : user command line input the plan was compiled from
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: NONE
+ **/
+static void run_plan (Command_Plan_t* plan, const char* line, Matrix_t** mats, unsigned int num_mats) {
+	const bool success = plan->def->handler(plan, mats, num_mats);
+	if (success && command_journal && plan->def->journaled) {
+		command_journal(plan->journal_line ? plan->journal_line : line, plan->def->external, mats, num_mats);
+	}
+	free(plan->journal_line);
+	plan->journal_line = NULL;
+}
+
+/*
+ * PURPOSE: Seeded FNV-1a hash of a string
+ * INPUTS:
+ *	str : String to hash
+ *	seed : Seed mixed into the starting state
+ * RETURN: 32 bit hash of str
+ **/
+static uint32_t hash_string (const char* str, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ (seed * 0x9E3779B1u);
+	for (; *str; ++str) {
+		hash ^= (unsigned char) *str;
+		hash *= 16777619u;
+	}
+	return hash ^ (hash >> 15);
+}
+
+/*
+ * PURPOSE: Copy and convert one argument according to its declared type
+ * INPUTS:
+ *	arg : Pointer to Command_Arg_t to fill in
+ *	type : Declared type of the argument
+ *	text : Argument as typed by the user
+ * RETURN: True if the argument is valid for its type, else false
+ **/
+static bool parse_argument (Command_Arg_t* arg, Arg_Type_t type, const char* text) {
+	arg->text = strdup(text);
+	if (!arg->text) {
+		return false;
+	}
+
+	switch (type) {
+		case ARG_NAME:
+			if (strlen(text) + 1 > MATRIX_NAME_LEN) {
+				printf("Matrix name (%s) is too long\n", text);
+				return false;
+			}
+			return true;
+		case ARG_UINT:
+		case ARG_SHIFT: {
+			char* end = NULL;
+			errno = 0;
+			const unsigned long value = strtoul(text, &end, 10);
+			if (*text == '-' || *end != '\0' || errno || value > UINT32_MAX) {
+				printf("Invalid number (%s)\n", text);
+				return false;
+			}
+			// Shifting a 32 bit element by 32 or more is undefined
+			if (type == ARG_SHIFT && value >= 32) {
+				printf("Invalid shift (%s), must be below 32\n", text);
+				return false;
+			}
+			arg->value = value;
+			return true;
+		}
+		case ARG_CHAR:
+			if (strlen(text) != 1) {
+				printf("Invalid character (%s)\n", text);
+				return false;
+			}
+			arg->value = text[0];
+			return true;
+		default:
+			return true;
+	}
+}
@@ -1,12 +1,70 @@
 #ifndef _COMMAND_H_
 #define _COMMAND_H_
 
+#include "matrix.h"
+
+#define MAX_CMD_ARGS 4
+#define NAME_PATTERN_CHARS "*?[" // A matrix argument holding any of these is a name pattern
+
 typedef struct {
 	unsigned int num_cmds;
 	char** cmds;
 }Commands_t;
 
+/* How a command argument is checked and pre-parsed when a plan is compiled */
+typedef enum {
+	ARG_MATRIX,	// Name of an existing matrix, resolved to a Matrix_t*
+	ARG_NAME,	// Name for a new matrix, checked against MATRIX_NAME_LEN
+	ARG_UINT,	// Unsigned decimal number
+	ARG_SHIFT,	// Bit shift count, an unsigned decimal number below 32
+	ARG_CHAR,	// Single character
+	ARG_FILE,	// Filename, passed through untouched
+	ARG_TEXT	// Free form text, passed through untouched
+}Arg_Type_t;
+
+typedef struct {
+	char* text;
+	unsigned int value;
+	Matrix_t* mat;
+}Command_Arg_t;
+
+struct Command_Plan;
+
+typedef bool (*Command_Handler_t)(struct Command_Plan* plan, Matrix_t** mats, unsigned int num_mats);
+typedef bool (*Command_Journal_t)(const char* line, bool checkpoint, Matrix_t** mats, unsigned int num_mats);
+
+typedef struct {
+	const char* name;
+	unsigned int min_args;
+	unsigned int max_args;
+	Arg_Type_t arg_types[MAX_CMD_ARGS];
+	Command_Handler_t handler;
+	bool batch; // First matrix argument may be a name pattern matching several matrices
+	bool journaled; // Changes the matrix array or a matrix, replayed from the journal
+	bool external; // Takes its input from a file or segment, captured by a checkpoint instead of replayed
+}Command_Def_t;
+
+/* A parsed command with every argument converted and every matrix looked up */
+typedef struct Command_Plan {
+	const Command_Def_t* def;
+	unsigned int num_args;
+	Command_Arg_t args[MAX_CMD_ARGS];
+	unsigned long generation;
+	Matrix_t** matches; // Matrices matching a name pattern, in array order
+	unsigned int num_matches; // Zero unless the command was given a name pattern
+	char* journal_line; // Set by a handler to journal a line other than the input, e.g. with a seed
+}Command_Plan_t;
+
 bool parse_user_input (const char* input, Commands_t** cmd);
 void destroy_commands(Commands_t** cmd);
 
+bool init_command_table (const Command_Def_t* defs, unsigned int num_defs);
+const Command_Def_t* lookup_command (const char* name);
+bool compile_command_plan (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats, Command_Plan_t** plan);
+bool resolve_command_plan (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+void destroy_command_plan (Command_Plan_t** plan);
+bool run_command_line (const char* line, Matrix_t** mats, unsigned int num_mats);
+void destroy_command_cache (void);
+void set_command_journal (Command_Journal_t journal);
+
 #endif
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "matrix.h"
+#include "convolve.h"
+#include "share.h"
+#include "util.h"
+
+/* Everything the row bands of one convolution share */
+typedef struct {
+	const Matrix_t* src;
+	Matrix_t* dest;
+	unsigned int kernel_rows;
+	unsigned int kernel_cols;
+	Border_Mode_t border;
+	bool separable; // Kernel is col_taps x row_taps, run as a row pass then a column pass
+	unsigned int taps[CONVOLVE_MAX_KERNEL * CONVOLVE_MAX_KERNEL];
+	unsigned int col_taps[CONVOLVE_MAX_KERNEL];
+	unsigned int row_taps[CONVOLVE_MAX_KERNEL];
+}Convolve_Job_t;
+
+/* Consecutive output rows computed by one thread */
+typedef struct {
+	const Convolve_Job_t* job;
+	unsigned int first_row;
+	unsigned int rows;
+	bool failed;
+}Convolve_Band_t;
+
+/*protected functions*/
+static void load_kernel (const Matrix_t* kernel, Convolve_Job_t* job);
+static bool factor_kernel (Convolve_Job_t* job);
+static void* convolve_band (void* arg);
+static void load_padded_row (const Convolve_Job_t* job, long row, unsigned int* padded, unsigned int* scratch);
+static unsigned int border_index (long index, unsigned int length, Border_Mode_t border, bool* inside);
+static inline void accumulate_tap (unsigned int* restrict out, const unsigned int* restrict in,
+			unsigned int tap, unsigned int count);
+static uint32_t attached_sequence (const Matrix_t* m);
+static bool attached_changed (const Matrix_t* m, uint32_t sequence);
+
+/*
+ * PURPOSE: Parse the border option of the convolve command
+ * INPUTS:
+ *	text : "zero", "clamp" or "wrap"
+ *	mode : Pointer to store the mode in
+ * RETURN: True if the text names a border mode, else false
+ **/
+bool parse_border_mode (const char* text, Border_Mode_t* mode) {
+	// Check parameters
+	if (!text || !mode) {
+		return false;
+	}
+	if (strncmp(text, "zero", strlen("zero") + 1) == 0) {
+		*mode = BORDER_ZERO;
+	}
+	else if (strncmp(text, "clamp", strlen("clamp") + 1) == 0) {
+		*mode = BORDER_CLAMP;
+	}
+	else if (strncmp(text, "wrap", strlen("wrap") + 1) == 0) {
+		*mode = BORDER_WRAP;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Convolve a matrix with a small kernel into a new matrix of the same
+ *	size. The kernel is centered on every element, its entries are taken as
+ *	signed 32 bit integers and the results wrap around like add does. Rank one
+ *	kernels (box blurs, gaussians, sobel) run as a row pass and a column pass.
+ *	Output rows are split into bands over the cores, every band pads the
+ *	source rows it needs once and accumulates one kernel tap at a time over a
+ *	block of columns.
+ * INPUTS:
+ *	src : Pointer to Matrix_t to convolve, may be a view or packed
+ *	kernel : Pointer to Matrix_t holding the kernel, both sides odd
+ *	border : What the kernel sees past the edge of src
+ *	name : Name of the new matrix
+ *	dest : Pointer to Matrix_t pointer to store the new matrix in
+ * RETURN: True if the new matrix was computed, else false
+ **/
+bool convolve_matrix (Matrix_t* src, Matrix_t* kernel, Border_Mode_t border, const char* name,
+			Matrix_t** dest) {
+	// Check parameters
+	if (!src || !kernel || !name || !dest || !MATRIX_HAS_DATA(src) || !MATRIX_HAS_DATA(kernel)) {
+		return false;
+	}
+	if (kernel->rows % 2 == 0 || kernel->cols % 2 == 0
+		|| kernel->rows > CONVOLVE_MAX_KERNEL || kernel->cols > CONVOLVE_MAX_KERNEL) {
+		printf("Kernel (%s,%u,%u) needs odd sides of at most %u\n", kernel->name, kernel->rows,
+			kernel->cols, CONVOLVE_MAX_KERNEL);
+		return false;
+	}
+
+	Convolve_Job_t* job = calloc(1, sizeof(Convolve_Job_t));
+	if (!job) {
+		return false;
+	}
+	if (!create_matrix_for_overwrite(dest, name, src->rows, src->cols)) {
+		free(job);
+		return false;
+	}
+	job->src = src;
+	job->dest = *dest;
+	job->kernel_rows = kernel->rows;
+	job->kernel_cols = kernel->cols;
+	job->border = border;
+
+	const unsigned int num_bands = count_threads(src->rows, CONVOLVE_MIN_BAND_ROWS, CONVOLVE_MAX_THREADS);
+	Convolve_Band_t bands[CONVOLVE_MAX_THREADS];
+
+	// Attached inputs can change under us, compute again until nothing overlapped a write
+	bool success = false;
+	for (unsigned int attempt = 0; attempt <= SHARE_MAX_RETRIES; ++attempt) {
+		const uint32_t src_sequence = attached_sequence(src);
+		const uint32_t kernel_sequence = attached_sequence(kernel);
+		load_kernel(kernel, job);
+		job->separable = factor_kernel(job);
+
+		success = true;
+		for (unsigned int i = 0; i < num_bands; ++i) {
+			bands[i].job = job;
+			bands[i].first_row = (unsigned int) ((uint64_t) src->rows * i / num_bands);
+			bands[i].rows = (unsigned int) ((uint64_t) src->rows * (i + 1) / num_bands) - bands[i].first_row;
+			bands[i].failed = false;
+		}
+		run_parallel(bands, sizeof(Convolve_Band_t), num_bands, convolve_band);
+		for (unsigned int i = 0; i < num_bands; ++i) {
+			success = success && !bands[i].failed;
+		}
+		if (!success || (!attached_changed(src, src_sequence) && !attached_changed(kernel, kernel_sequence))) {
+			break;
+		}
+		success = false;
+		if (attempt == SHARE_MAX_RETRIES) {
+			printf("SHARED MATRIX IS BUSY\n");
+		}
+	}
+
+	free(job);
+	if (!success) {
+		destroy_matrix(dest);
+		return false;
+	}
+	return true;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Copy the kernel entries into the job, row by row
+ * INPUTS:
+ *	kernel : Pointer to Matrix_t holding the kernel, may be a view or packed
+ *	job : Pointer to Convolve_Job_t to fill taps of
+ * RETURN: NONE
+ **/
+static void load_kernel (const Matrix_t* kernel, Convolve_Job_t* job) {
+	unsigned int scratch[CONVOLVE_MAX_KERNEL];
+	for (unsigned int i = 0; i < kernel->rows; ++i) {
+		const unsigned int* row = matrix_row(kernel, i, scratch);
+		memcpy(&job->taps[i * kernel->cols], row, sizeof(unsigned int) * kernel->cols);
+	}
+}
+
+/*
+ * PURPOSE: Split a rank one kernel into a column and a row of integer taps,
+ *	K[i][j] == col_taps[i] * row_taps[j] exactly. The row of the first non
+ *	zero entry divided by its gcd is a primitive integer vector, so every
+ *	other row is an integer multiple of it.
+ * INPUTS:
+ *	job : Pointer to Convolve_Job_t with taps loaded, col_taps and row_taps are filled in
+ * RETURN: True if the kernel is separable and worth splitting, else false
+ **/
+static bool factor_kernel (Convolve_Job_t* job) {
+	const unsigned int kr = job->kernel_rows;
+	const unsigned int kc = job->kernel_cols;
+	if (kr == 1 || kc == 1) {
+		return false;
+	}
+	#define TAP(i, j) ((int64_t) (int32_t) job->taps[(i) * kc + (j)])
+
+	unsigned int p = 0;
+	unsigned int q = 0;
+	while (p < kr && TAP(p, q) == 0) {
+		if (++q == kc) {
+			q = 0;
+			++p;
+		}
+	}
+	if (p == kr) {
+		return false;
+	}
+
+	int64_t g = 0;
+	for (unsigned int j = 0; j < kc; ++j) {
+		int64_t a = TAP(p, j) < 0 ? -TAP(p, j) : TAP(p, j);
+		while (a) {
+			const int64_t t = g % a;
+			g = a;
+			a = t;
+		}
+	}
+	for (unsigned int i = 0; i < kr; ++i) {
+		for (unsigned int j = 0; j < kc; ++j) {
+			if (TAP(i, j) * TAP(p, q) != TAP(i, q) * TAP(p, j)) {
+				return false;
+			}
+		}
+	}
+	const int64_t pivot = TAP(p, q) / g;
+	for (unsigned int j = 0; j < kc; ++j) {
+		job->row_taps[j] = (unsigned int) (TAP(p, j) / g);
+	}
+	for (unsigned int i = 0; i < kr; ++i) {
+		job->col_taps[i] = (unsigned int) (TAP(i, q) / pivot);
+	}
+	#undef TAP
+	return true;
+}
+
+/*
+ * PURPOSE: Compute the output rows of one band. The source rows under the
+ *	kernel are kept in a ring of kernel_rows slots, so each is padded (and
+ *	for a separable kernel filtered along the row) once per band.
+ * INPUTS:
+ *	arg : Pointer to Convolve_Band_t
+ * RETURN: NULL, failed is set in the band if its buffers could not be allocated
+ **/
+static void* convolve_band (void* arg) {
+	Convolve_Band_t* band = arg;
+	const Convolve_Job_t* job = band->job;
+	const unsigned int cols = job->src->cols;
+	const unsigned int kr = job->kernel_rows;
+	const unsigned int kc = job->kernel_cols;
+	const size_t padded_cols = (size_t) cols + kc - 1;
+	const size_t slot_cols = job->separable ? cols : padded_cols;
+
+	unsigned int* ring = malloc(sizeof(unsigned int) * slot_cols * kr);
+	unsigned int* padded = malloc(sizeof(unsigned int) * padded_cols);
+	unsigned int* scratch = malloc(sizeof(unsigned int) * cols);
+	if (!ring || !padded || !scratch) {
+		band->failed = true;
+		free(ring);
+		free(padded);
+		free(scratch);
+		return NULL;
+	}
+	long tags[CONVOLVE_MAX_KERNEL];
+	for (unsigned int a = 0; a < kr; ++a) {
+		tags[a] = LONG_MIN;
+	}
+
+	const unsigned int* window[CONVOLVE_MAX_KERNEL];
+	for (unsigned int i = band->first_row; i < band->first_row + band->rows; ++i) {
+		// Bring the source rows under the kernel into the ring
+		for (unsigned int a = 0; a < kr; ++a) {
+			const long row = (long) i + a - kr / 2;
+			const unsigned int slot = (unsigned int) (((row % (long) kr) + kr) % kr);
+			unsigned int* slot_row = &ring[slot * slot_cols];
+			if (tags[slot] != row) {
+				if (job->separable) {
+					load_padded_row(job, row, padded, scratch);
+					memset(slot_row, 0, sizeof(unsigned int) * cols);
+					for (unsigned int b = 0; b < kc; ++b) {
+						if (job->row_taps[b]) {
+							accumulate_tap(slot_row, &padded[b], job->row_taps[b], cols);
+						}
+					}
+				}
+				else {
+					load_padded_row(job, row, slot_row, scratch);
+				}
+				tags[slot] = row;
+			}
+			window[a] = slot_row;
+		}
+
+		// One tap at a time over a block of columns, the inner loop vectorizes (built with VECFLAGS)
+		unsigned int* out = &job->dest->data[(size_t) i * job->dest->stride];
+		for (unsigned int j0 = 0; j0 < cols; j0 += CONVOLVE_BLOCK_COLS) {
+			const unsigned int count = cols - j0 < CONVOLVE_BLOCK_COLS ? cols - j0 : CONVOLVE_BLOCK_COLS;
+			memset(&out[j0], 0, sizeof(unsigned int) * count);
+			for (unsigned int a = 0; a < kr; ++a) {
+				if (job->separable) {
+					if (job->col_taps[a]) {
+						accumulate_tap(&out[j0], &window[a][j0], job->col_taps[a], count);
+					}
+					continue;
+				}
+				for (unsigned int b = 0; b < kc; ++b) {
+					const unsigned int tap = job->taps[a * kc + b];
+					if (tap) {
+						accumulate_tap(&out[j0], &window[a][j0 + b], tap, count);
+					}
+				}
+			}
+		}
+	}
+
+	free(ring);
+	free(padded);
+	free(scratch);
+	return NULL;
+}
+
+/*
+ * PURPOSE: Fill a buffer with one source row plus kernel_cols / 2 border
+ *	elements on either side
+ * INPUTS:
+ *	job : Pointer to Convolve_Job_t
+ *	row : Index of the source row, may lie past either edge
+ *	padded : Pointer to room for cols + kernel_cols - 1 elements
+ *	scratch : Pointer to room for one row, used when the source is packed
+ * RETURN: NONE
+ **/
+static void load_padded_row (const Convolve_Job_t* job, long row, unsigned int* padded, unsigned int* scratch) {
+	const unsigned int cols = job->src->cols;
+	const unsigned int half = job->kernel_cols / 2;
+	bool inside = false;
+	const unsigned int r = border_index(row, job->src->rows, job->border, &inside);
+	if (!inside) {
+		memset(padded, 0, sizeof(unsigned int) * (cols + 2 * half));
+		return;
+	}
+	const unsigned int* src_row = matrix_row(job->src, r, scratch);
+	memcpy(&padded[half], src_row, sizeof(unsigned int) * cols);
+	for (unsigned int x = 0; x < half; ++x) {
+		const unsigned int left = border_index((long) x - half, cols, job->border, &inside);
+		padded[x] = inside ? src_row[left] : 0;
+		const unsigned int right = border_index((long) cols + x, cols, job->border, &inside);
+		padded[half + cols + x] = inside ? src_row[right] : 0;
+	}
+}
+
+/*
+ * PURPOSE: Map an index past the edge of a dimension by the border mode
+ * INPUTS:
+ *	index : Index, may be negative or past the end
+ *	length : Size of the dimension
+ *	border : Border mode
+ *	inside : Pointer to store whether the index maps onto an element, false for zeros
+ * RETURN: Index of the element to use
+ **/
+static unsigned int border_index (long index, unsigned int length, Border_Mode_t border, bool* inside) {
+	*inside = true;
+	if (index >= 0 && index < (long) length) {
+		return (unsigned int) index;
+	}
+	switch (border) {
+		case BORDER_CLAMP:
+			return index < 0 ? 0 : length - 1;
+		case BORDER_WRAP: {
+			const long wrapped = index % (long) length;
+			return (unsigned int) (wrapped < 0 ? wrapped + length : wrapped);
+		}
+		default:
+			*inside = false;
+			return 0;
+	}
+}
+
+/*
+ * PURPOSE: Add one kernel tap times a run of inputs onto a run of outputs
+ * INPUTS:
+ *	out : Pointer to the outputs
+ *	in : Pointer to the inputs, not overlapping out
+ *	tap : Kernel entry
+ *	count : Number of elements
+ * RETURN: NONE
+ **/
+static inline void accumulate_tap (unsigned int* restrict out, const unsigned int* restrict in,
+			unsigned int tap, unsigned int count) {
+	for (unsigned int j = 0; j < count; ++j) {
+		out[j] += tap * in[j];
+	}
+}
+
+/*
+ * PURPOSE: Start a consistent read of a matrix attached from another process
+ * INPUTS:
+ *	m : Pointer to Matrix_t
+ * RETURN: Sequence to pass to attached_changed, zero for other matrices
+ **/
+static uint32_t attached_sequence (const Matrix_t* m) {
+	const Matrix_t* owner = m->parent ? m->parent : m;
+	return owner->read_only ? share_read_begin(owner->share->header) : 0;
+}
+
+/*
+ * PURPOSE: Check whether an attached matrix was written since attached_sequence
+ * INPUTS:
+ *	m : Pointer to Matrix_t
+ *	sequence : Value returned by attached_sequence
+ * RETURN: True if what was read may be torn, else false
+ **/
+static bool attached_changed (const Matrix_t* m, uint32_t sequence) {
+	const Matrix_t* owner = m->parent ? m->parent : m;
+	return owner->read_only && share_read_retry(owner->share->header, sequence);
+}
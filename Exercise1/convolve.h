@@ -0,0 +1,20 @@
+#ifndef _CONVOLVE_H_
+#define _CONVOLVE_H_
+
+#define CONVOLVE_MAX_KERNEL 31 // Largest kernel side, kernels have odd sides so they have a center
+#define CONVOLVE_BLOCK_COLS 2048 // Output columns accumulated at once, sized to stay in L1/L2
+#define CONVOLVE_MIN_BAND_ROWS 64 // Fewest output rows worth a thread of their own
+#define CONVOLVE_MAX_THREADS 16
+
+/* What a kernel sees past the edge of the matrix */
+typedef enum {
+	BORDER_ZERO, // Zeros
+	BORDER_CLAMP, // The nearest edge element
+	BORDER_WRAP // The matrix repeated, the other side
+}Border_Mode_t;
+
+bool parse_border_mode (const char* text, Border_Mode_t* mode);
+bool convolve_matrix (Matrix_t* src, Matrix_t* kernel, Border_Mode_t border, const char* name,
+			Matrix_t** dest);
+
+#endif
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "matrix.h"
+#include "csv.h"
+#include "util.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CSV_SWAR 1
+#endif
+
+/* One newline aligned slice of the input, parsed by one thread */
+typedef struct {
+	const char* begin;
+	const char* end;
+	const char* file_end;
+	unsigned int first_row;
+	unsigned int rows;
+	Matrix_t* m;
+	bool failed;
+	unsigned int error_row;
+}Csv_Chunk_t;
+
+static const uint64_t powers_of_ten[9] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+/*protected functions*/
+static void* count_chunk_rows (void* arg);
+static void* parse_chunk (void* arg);
+static bool parse_value (const char** cursor, const char* end, const char* file_end, unsigned int* value);
+
+/*
+ * PURPOSE: Load a comma separated text file of integers into a new matrix. The
+ *	file is mapped and split on line boundaries; a first pass counts the rows
+ *	of every slice so the matrix is allocated once, and a second pass parses
+ *	each slice straight into its rows on its own thread.
+ * INPUTS:
+ *	csv_filename : filename of the text file to import
+ *	name : Name of the new matrix
+ *	m : Pointer to Matrix_t pointer to store the new matrix in
+ * RETURN: True if every line parsed into the same number of columns, else false
+ **/
+bool import_csv (const char* csv_filename, const char* name, Matrix_t** m) {
+	// Check parameters
+	if (!csv_filename || !name || !m) {
+		return false;
+	}
+
+	int fd = open(csv_filename, O_RDONLY);
+	if (fd < 0) {
+		printf("FAILED TO OPEN FOR READING\n");
+		if (errno == EACCES) {
+			perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size == 0) {
+		printf("CSV FILE IS EMPTY\n");
+		close(fd);
+		return false;
+	}
+
+	const size_t length = st.st_size;
+	const char* base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("FAILED TO MAP CSV FILE\n");
+		return false;
+	}
+	madvise((void*) base, length, MADV_SEQUENTIAL);
+	const char* file_end = base + length;
+
+	/* The first line decides the column count */
+	const char* first_newline = memchr(base, '\n', length);
+	const char* first_end = first_newline ? first_newline : file_end;
+	unsigned int cols = 1;
+	for (const char* p = base; p < first_end; ++p) {
+		cols += (*p == ',');
+	}
+
+	/* Split on line boundaries, a chunk may end up empty for short files */
+	Csv_Chunk_t chunks[CSV_MAX_THREADS];
+	memset(chunks, 0, sizeof(chunks));
+	const unsigned int num_chunks = count_threads(length, CSV_MIN_CHUNK_BYTES, CSV_MAX_THREADS);
+	const char* begin = base;
+	for (unsigned int i = 0; i < num_chunks; ++i) {
+		const char* end = file_end;
+		if (i + 1 < num_chunks) {
+			end = base + length / num_chunks * (i + 1);
+			if (end < begin) {
+				end = begin;
+			}
+			const char* newline = memchr(end, '\n', file_end - end);
+			end = newline ? newline + 1 : file_end;
+		}
+		chunks[i].begin = begin;
+		chunks[i].end = end;
+		chunks[i].file_end = file_end;
+		begin = end;
+	}
+
+	/* Pass one: rows per chunk, giving every chunk its first row */
+	run_parallel(chunks, sizeof(Csv_Chunk_t), num_chunks, count_chunk_rows);
+	bool success = true;
+	uint64_t rows = 0;
+	for (unsigned int i = 0; i < num_chunks; ++i) {
+		chunks[i].first_row = rows;
+		rows += chunks[i].rows;
+	}
+	if ((rows == 0 || rows * cols > UINT32_MAX / sizeof(unsigned int))) {
+		printf("CSV FILE HAS UNSUPPORTED DIMENSIONS\n");
+		success = false;
+	}
+
+	if (success && !create_matrix_for_overwrite(m, name, rows, cols)) {
+		success = false;
+	}
+
+	/* Pass two: parse every chunk into its own rows */
+	if (success) {
+		for (unsigned int i = 0; i < num_chunks; ++i) {
+			chunks[i].m = *m;
+		}
+		run_parallel(chunks, sizeof(Csv_Chunk_t), num_chunks, parse_chunk);
+		for (unsigned int i = 0; i < num_chunks; ++i) {
+			if (chunks[i].failed) {
+				printf("CSV PARSE ERROR ON LINE %u, EXPECTED %u INTEGER COLUMNS\n",
+					chunks[i].error_row + 1, cols);
+				success = false;
+				break;
+			}
+		}
+		if (!success) {
+			destroy_matrix(m);
+		}
+	}
+
+	munmap((void*) base, length);
+	return success;
+}
+
+/*
+ * PURPOSE: Write a matrix out as comma separated text, one row per line
+ * INPUTS:
+ *	csv_filename : filename of the text file to write
+ *	m : Pointer to Matrix_t to export
+ * RETURN: True if the whole matrix was written, else false
+ **/
+bool export_csv (const char* csv_filename, Matrix_t* m) {
+	// Check parameters
+	if (!csv_filename || !m || !MATRIX_HAS_DATA(m)) {
+		return false;
+	}
+
+	int fd = open(csv_filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("FAILED TO CREATE/OPEN FILE FOR WRITING\n");
+		if (errno == EACCES) {
+			perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		return false;
+	}
+
+	char* buffer = malloc(CSV_WRITE_BUFFER_BYTES);
+	unsigned int* scratch = m->packed ? malloc(m->cols * sizeof(unsigned int)) : NULL;
+	if (!buffer || (m->packed && !scratch)) {
+		free(buffer);
+		close(fd);
+		return false;
+	}
+
+	bool success = true;
+	size_t used = 0;
+	for (unsigned int i = 0; success && i < m->rows; ++i) {
+		const unsigned int* row = matrix_row(m, i, scratch);
+		for (unsigned int j = 0; success && j < m->cols; ++j) {
+			// Room for ten digits and a separator
+			if (used + 11 > CSV_WRITE_BUFFER_BYTES) {
+				success = write_fully(fd, buffer, used, -1);
+				used = 0;
+			}
+
+			char digits[10];
+			unsigned int num_digits = 0;
+			unsigned int value = row[j];
+			do {
+				digits[num_digits++] = '0' + value % 10;
+				value /= 10;
+			} while (value);
+			while (num_digits) {
+				buffer[used++] = digits[--num_digits];
+			}
+			buffer[used++] = (j + 1 < m->cols) ? ',' : '\n';
+		}
+	}
+	if (success) {
+		success = write_fully(fd, buffer, used, -1);
+	}
+	if (!success) {
+		printf("FAILED TO WRITE MATRIX TO FILE\n");
+	}
+
+	free(buffer);
+	free(scratch);
+	if (close(fd)) {
+		return false;
+	}
+	return success;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Count the lines of one chunk, a last line without a newline counts
+ * INPUTS:
+ *	arg : Pointer to Csv_Chunk_t to count
+ * RETURN: NULL
+ **/
+static void* count_chunk_rows (void* arg) {
+	Csv_Chunk_t* chunk = arg;
+	const char* p = chunk->begin;
+	while (p < chunk->end) {
+		const char* newline = memchr(p, '\n', chunk->end - p);
+		chunk->rows++;
+		if (!newline) {
+			break;
+		}
+		p = newline + 1;
+	}
+	return NULL;
+}
+
+/*
+ * PURPOSE: Parse every line of one chunk into its rows of the matrix
+ * INPUTS:
+ *	arg : Pointer to Csv_Chunk_t to parse
+ * RETURN: NULL, failures are flagged in the chunk
+ **/
+static void* parse_chunk (void* arg) {
+	Csv_Chunk_t* chunk = arg;
+	Matrix_t* m = chunk->m;
+	const char* p = chunk->begin;
+	const char* end = chunk->end;
+
+	for (unsigned int row = 0; row < chunk->rows; ++row) {
+		unsigned int* dst = &m->data[(chunk->first_row + row) * m->stride];
+		bool parsed = true;
+		for (unsigned int col = 0; parsed && col < m->cols; ++col) {
+			while (p < end && (*p == ' ' || *p == '\t')) {
+				p++;
+			}
+			if (col > 0) {
+				if (p == end || *p != ',') {
+					parsed = false;
+					break;
+				}
+				p++;
+				while (p < end && (*p == ' ' || *p == '\t')) {
+					p++;
+				}
+			}
+			parsed = parse_value(&p, end, chunk->file_end, &dst[col]);
+		}
+
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+			p++;
+		}
+		// Only the very last line of the file may end without a newline
+		if (!parsed || (p < end && *p != '\n')) {
+			chunk->failed = true;
+			chunk->error_row = chunk->first_row + row;
+			return NULL;
+		}
+		if (p < end) {
+			p++;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * PURPOSE: Parse one decimal integer, negative values are stored as two's
+ *	complement. Eight digits are classified and converted at once with SWAR
+ *	arithmetic on a 64 bit word while a full word can be loaded.
+ * INPUTS:
+ *	cursor : Pointer to the parse position, advanced past the number
+ *	end : End of the current chunk
+ *	file_end : End of the mapping, word loads never cross it
+ *	value : Pointer to store the parsed value in
+ * RETURN: True if a number in range was parsed, else false
+ **/
+static bool parse_value (const char** cursor, const char* end, const char* file_end, unsigned int* value) {
+	const char* p = *cursor;
+	bool negative = false;
+	if (p < end && *p == '-') {
+		negative = true;
+		p++;
+	}
+
+	const char* digits = p;
+	uint64_t result = 0;
+#ifdef CSV_SWAR
+	while (p + 8 <= file_end && result <= UINT32_MAX) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		// Bytes 0-9 are digits, anything else gets its high bit set
+		const uint64_t t = word ^ 0x3030303030303030ULL;
+		const uint64_t non_digit = (((t & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | t)
+			& 0x8080808080808080ULL;
+		const unsigned int n = non_digit ? __builtin_ctzll(non_digit) / 8 : 8;
+		if (n == 0) {
+			break;
+		}
+		// Leading zero bytes stand in for the digits that are not there
+		uint64_t v = (n == 8) ? t : t << (8 * (8 - n));
+		v = (v * 10) + (v >> 8);
+		v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+			+ (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+		result = result * powers_of_ten[n] + v;
+		p += n;
+		if (n < 8) {
+			break;
+		}
+	}
+#endif
+	while (p < end && *p >= '0' && *p <= '9' && result <= UINT32_MAX) {
+		result = result * 10 + (*p - '0');
+		p++;
+	}
+
+	// Digits left over mean the value does not fit
+	if (p == digits || (p < end && *p >= '0' && *p <= '9')) {
+		return false;
+	}
+	if (negative) {
+		if (result > (uint64_t) INT32_MAX + 1) {
+			return false;
+		}
+		*value = (unsigned int) -(int64_t) result;
+	}
+	else {
+		if (result > UINT32_MAX) {
+			return false;
+		}
+		*value = result;
+	}
+	*cursor = p;
+	return true;
+}
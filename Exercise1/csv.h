@@ -0,0 +1,11 @@
+#ifndef _CSV_H_
+#define _CSV_H_
+
+#define CSV_MAX_THREADS 16
+#define CSV_MIN_CHUNK_BYTES (1 << 20)
+#define CSV_WRITE_BUFFER_BYTES (1 << 16)
+
+bool import_csv (const char* csv_filename, const char* name, Matrix_t** m);
+bool export_csv (const char* csv_filename, Matrix_t* m);
+
+#endif
@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "matrix.h"
+#include "command.h"
+#include "workspace.h"
+#include "journal.h"
+#include "util.h"
+
+/* Journal of the running program, records are queued here for the flusher thread */
+typedef struct {
+	char* filename;
+	char* checkpoint_filename;
+	int fd;
+	uint32_t epoch;
+	bool started;
+	pthread_t flusher;
+	pthread_mutex_t lock;
+	pthread_cond_t wake; // Signalled when records are queued or the flusher has to stop
+	pthread_cond_t flushed; // Broadcast when a batch of records is on disk
+	char* pending;
+	size_t pending_len;
+	size_t pending_cap;
+	unsigned long appended; // Records queued so far
+	unsigned long durable; // Records written and synced so far
+	bool stop;
+	bool failed;
+	unsigned int records_since_checkpoint;
+}Journal_t;
+
+static Journal_t journal = {
+	.fd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.flushed = PTHREAD_COND_INITIALIZER,
+};
+
+/*protected functions*/
+static bool append_record (const char* line, bool checkpoint, Matrix_t** mats, unsigned int num_mats);
+static void stop_journaling (const char* reason);
+static void* run_flusher (void* arg);
+static bool sync_journal (void);
+static bool write_checkpoint (Matrix_t** mats, unsigned int num_mats);
+static int create_journal_file (uint32_t epoch);
+static unsigned int replay_records (int fd, Matrix_t** mats, unsigned int num_mats);
+static uint32_t record_checksum (const char* line, uint32_t length);
+static void sync_parent_directory (const char* filename);
+
+/*
+ * PURPOSE: Restore the state a journal describes: load its checkpoint
+ *	workspace, then replay every intact record appended after it. A torn
+ *	record at the end, left by a crash during a write, ends the replay and is
+ *	cut off. Nothing is journaled until start_journal is called.
+ * INPUTS:
+ *	journal_filename : filename of the journal, the checkpoint is <journal_filename>.ckpt
+ *	mats : Pointer to Matrix_t array to restore into
+ *	num_mats : Number of matrices in mats array
+ *	restored : Pointer to store whether there was a checkpoint to restore in
+ * RETURN: True if the journal is usable, else false
+ **/
+bool open_journal (const char* journal_filename, Matrix_t** mats, unsigned int num_mats, bool* restored) {
+	// Check parameters
+	if (!journal_filename || !mats || !restored || journal.filename) {
+		return false;
+	}
+	*restored = false;
+
+	const size_t len = strlen(journal_filename) + strlen(".ckpt") + 1;
+	journal.filename = strdup(journal_filename);
+	journal.checkpoint_filename = calloc(len, sizeof(char));
+	if (!journal.filename || !journal.checkpoint_filename) {
+		close_journal();
+		return false;
+	}
+	snprintf(journal.checkpoint_filename, len, "%s.ckpt", journal_filename);
+
+	uint32_t checkpoint_epoch = 0;
+	if (access(journal.checkpoint_filename, F_OK) == 0) {
+		unsigned int loaded = 0;
+		if (!read_workspace_journal_epoch(journal.checkpoint_filename, &checkpoint_epoch)
+			|| !load_workspace(journal.checkpoint_filename, mats, num_mats, &loaded)) {
+			printf("FAILED TO LOAD JOURNAL CHECKPOINT (%s)\n", journal.checkpoint_filename);
+			close_journal();
+			return false;
+		}
+		printf("Checkpoint (%s) restored with %u matrices\n", journal.checkpoint_filename, loaded);
+		*restored = true;
+	}
+	journal.epoch = checkpoint_epoch;
+
+	int fd = open(journal.filename, O_RDWR);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			printf("FAILED TO OPEN JOURNAL (%s)\n", journal.filename);
+			close_journal();
+			return false;
+		}
+		// Nothing was journaled yet
+		return true;
+	}
+
+	Journal_Header_t header;
+	if (read(fd, &header, sizeof(header)) != sizeof(header)
+		|| memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != JOURNAL_VERSION) {
+		printf("NOT A JOURNAL FILE (%s)\n", journal.filename);
+		close(fd);
+		close_journal();
+		return false;
+	}
+	if (!(*restored) || header.epoch > checkpoint_epoch) {
+		printf("JOURNAL (%s) DOES NOT BELONG TO ITS CHECKPOINT\n", journal.filename);
+		close(fd);
+		close_journal();
+		return false;
+	}
+	if (header.epoch < checkpoint_epoch) {
+		// The checkpoint was written but the crash came before the journal was restarted
+		close(fd);
+		return true;
+	}
+
+	const unsigned int replayed = replay_records(fd, mats, num_mats);
+	journal.fd = fd;
+	journal.records_since_checkpoint = replayed;
+	printf("Journal (%s) replayed %u commands\n", journal.filename, replayed);
+	return true;
+}
+
+/*
+ * PURPOSE: Start journaling every command marked journaled. The workspace is
+ *	checkpointed first so the journal only has to hold what follows.
+ * INPUTS:
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if journaling started, else false
+ **/
+bool start_journal (Matrix_t** mats, unsigned int num_mats) {
+	// Check parameters
+	if (!mats || !journal.filename || journal.started) {
+		return false;
+	}
+
+	// Without a checkpoint there has to be a replayed journal to append to
+	if (!write_checkpoint(mats, num_mats) && (journal.fd < 0 || journal.failed)) {
+		printf("FAILED TO CHECKPOINT WORKSPACE INTO (%s)\n", journal.checkpoint_filename);
+		return false;
+	}
+	if (lseek(journal.fd, 0, SEEK_END) < 0) {
+		return false;
+	}
+
+	if (pthread_create(&journal.flusher, NULL, run_flusher, NULL) != 0) {
+		return false;
+	}
+	journal.started = true;
+	set_command_journal(append_record);
+	return true;
+}
+
+/*
+ * PURPOSE: Save the workspace as the new checkpoint and restart the journal
+ *	empty. While any view or attached matrix exists the checkpoint is put off,
+ *	either would come back as a plain writable copy and later commands would
+ *	replay differently.
+ * INPUTS:
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if a checkpoint was written, else false
+ **/
+bool checkpoint_journal (Matrix_t** mats, unsigned int num_mats) {
+	// Check parameters
+	if (!mats || !journal.started) {
+		return false;
+	}
+	if (!sync_journal()) {
+		return false;
+	}
+	return write_checkpoint(mats, num_mats);
+}
+
+/*
+ * PURPOSE: Write out every queued record, stop journaling and free the journal
+ * INPUTS: NONE
+ * RETURN: NONE
+ **/
+void close_journal (void) {
+	if (journal.started) {
+		set_command_journal(NULL);
+		pthread_mutex_lock(&journal.lock);
+		journal.stop = true;
+		pthread_cond_signal(&journal.wake);
+		pthread_mutex_unlock(&journal.lock);
+		pthread_join(journal.flusher, NULL);
+	}
+	if (journal.fd >= 0) {
+		close(journal.fd);
+	}
+	free(journal.filename);
+	free(journal.checkpoint_filename);
+	free(journal.pending);
+
+	journal.filename = NULL;
+	journal.checkpoint_filename = NULL;
+	journal.fd = -1;
+	journal.epoch = 0;
+	journal.started = false;
+	journal.pending = NULL;
+	journal.pending_len = 0;
+	journal.pending_cap = 0;
+	journal.appended = 0;
+	journal.durable = 0;
+	journal.stop = false;
+	journal.failed = false;
+	journal.records_since_checkpoint = 0;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Queue one command line for the flusher thread and wait until it
+ *	is synced, the command hook installed by start_journal. Every JOURNAL_CHECKPOINT_RECORDS records the
+ *	workspace is checkpointed so replay stays short. A command that read a
+ *	file or segment is not journaled, the input may have changed by replay
+ *	time; the workspace is checkpointed right away instead, and when that is
+ *	not possible journaling stops.
+ * INPUTS:
+ *	line : Command line to journal
+ *	checkpoint : Capture the command with a checkpoint instead of a record
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command is journaled and on disk, else false
+ **/
+static bool append_record (const char* line, bool checkpoint, Matrix_t** mats, unsigned int num_mats) {
+	if (checkpoint) {
+		if (!checkpoint_journal(mats, num_mats)) {
+			stop_journaling("NO CHECKPOINT POSSIBLE AFTER READING OUTSIDE INPUT WHILE VIEWS OR ATTACHED MATRICES EXIST");
+			return false;
+		}
+		return true;
+	}
+
+	const size_t length = strlen(line);
+	if (length == 0 || length > JOURNAL_MAX_LINE) {
+		printf("COMMAND IS TOO LONG TO JOURNAL\n");
+		return false;
+	}
+	Journal_Record_t record = {length, record_checksum(line, length)};
+
+	pthread_mutex_lock(&journal.lock);
+	if (journal.failed) {
+		pthread_mutex_unlock(&journal.lock);
+		return false;
+	}
+	const size_t needed = journal.pending_len + sizeof(record) + length;
+	if (needed > journal.pending_cap) {
+		size_t cap = journal.pending_cap ? journal.pending_cap : 4096;
+		while (cap < needed) {
+			cap *= 2;
+		}
+		char* pending = realloc(journal.pending, cap);
+		if (!pending) {
+			pthread_mutex_unlock(&journal.lock);
+			return false;
+		}
+		journal.pending = pending;
+		journal.pending_cap = cap;
+	}
+	memcpy(&journal.pending[journal.pending_len], &record, sizeof(record));
+	memcpy(&journal.pending[journal.pending_len + sizeof(record)], line, length);
+	journal.pending_len = needed;
+	const unsigned long sequence = ++journal.appended;
+	pthread_cond_signal(&journal.wake);
+
+	// The command counts as done once this returns, so wait until its record is on disk
+	while (journal.durable < sequence) {
+		pthread_cond_wait(&journal.flushed, &journal.lock);
+	}
+	const bool durable = !journal.failed;
+	pthread_mutex_unlock(&journal.lock);
+	if (!durable) {
+		return false;
+	}
+
+	if (++journal.records_since_checkpoint >= JOURNAL_CHECKPOINT_RECORDS) {
+		checkpoint_journal(mats, num_mats);
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Flusher thread. Takes everything queued since the last round and
+ *	writes it with one write and one fdatasync, so records queued while a
+ *	sync is running share the next one (group commit). Every waiting
+ *	append_record is woken once its record is covered.
+ * INPUTS:
+ *	arg : Unused
+ * RETURN: NULL
+ **/
+static void* run_flusher (void* arg) {
+	char* batch = NULL;
+	size_t batch_cap = 0;
+
+	pthread_mutex_lock(&journal.lock);
+	for (;;) {
+		while (!journal.stop && journal.pending_len == 0) {
+			pthread_cond_wait(&journal.wake, &journal.lock);
+		}
+		if (journal.pending_len == 0) {
+			break;
+		}
+
+		// Swap buffers so new records go into the other one while this batch is written
+		char* full = journal.pending;
+		const size_t full_cap = journal.pending_cap;
+		const size_t length = journal.pending_len;
+		journal.pending = batch;
+		journal.pending_cap = batch_cap;
+		journal.pending_len = 0;
+		batch = full;
+		batch_cap = full_cap;
+		const unsigned long sequence = journal.appended;
+		const int fd = journal.fd;
+		const bool failed = journal.failed;
+		pthread_mutex_unlock(&journal.lock);
+
+		const bool success = !failed && write_fully(fd, batch, length, -1) && fdatasync(fd) == 0;
+
+		if (!success) {
+			stop_journaling("FAILED TO WRITE JOURNAL");
+		}
+		pthread_mutex_lock(&journal.lock);
+		journal.durable = sequence;
+		pthread_cond_broadcast(&journal.flushed);
+	}
+	pthread_mutex_unlock(&journal.lock);
+
+	free(batch);
+	return NULL;
+}
+
+/*
+ * PURPOSE: Give up on journaling, the journal no longer describes the workspace
+ * INPUTS:
+ *	reason : Why, printed the first time only
+ * RETURN: NONE
+ **/
+static void stop_journaling (const char* reason) {
+	pthread_mutex_lock(&journal.lock);
+	const bool first = !journal.failed;
+	journal.failed = true;
+	pthread_mutex_unlock(&journal.lock);
+	if (first) {
+		printf("%s, JOURNALING STOPPED\n", reason);
+	}
+}
+
+/*
+ * PURPOSE: Wait until every queued record is on disk
+ * INPUTS: NONE
+ * RETURN: True if all of them were written, else false
+ **/
+static bool sync_journal (void) {
+	pthread_mutex_lock(&journal.lock);
+	while (journal.durable < journal.appended) {
+		pthread_cond_wait(&journal.flushed, &journal.lock);
+	}
+	const bool success = !journal.failed;
+	pthread_mutex_unlock(&journal.lock);
+	return success;
+}
+
+/*
+ * PURPOSE: Save the checkpoint tagged with the next epoch, then replace the
+ *	journal by an empty one of that epoch. A crash between the two leaves an
+ *	older journal, which open_journal knows the checkpoint already covers.
+ *	The flusher must be idle, every queued record written.
+ * INPUTS:
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the checkpoint was written, else false
+ **/
+static bool write_checkpoint (Matrix_t** mats, unsigned int num_mats) {
+	for (unsigned int i = 0; i < num_mats; ++i) {
+		if (mats[i] && (mats[i]->parent || mats[i]->views || mats[i]->read_only)) {
+			return false;
+		}
+	}
+
+	const uint32_t epoch = journal.epoch + 1;
+	if (!save_workspace(journal.checkpoint_filename, mats, num_mats, epoch)) {
+		return false;
+	}
+	sync_parent_directory(journal.checkpoint_filename);
+
+	const int fd = create_journal_file(epoch);
+	if (fd < 0) {
+		// The old journal is covered by the new checkpoint, appending to it would lose commands
+		stop_journaling("FAILED TO RESTART JOURNAL");
+		return false;
+	}
+
+	pthread_mutex_lock(&journal.lock);
+	if (journal.fd >= 0) {
+		close(journal.fd);
+	}
+	journal.fd = fd;
+	pthread_mutex_unlock(&journal.lock);
+	journal.epoch = epoch;
+	journal.records_since_checkpoint = 0;
+	return true;
+}
+
+/*
+ * PURPOSE: Create an empty journal of an epoch under a temporary name and
+ *	rename it over the journal file
+ * INPUTS:
+ *	epoch : Epoch to write into the header
+ * RETURN: File descriptor positioned after the header, else -1
+ **/
+static int create_journal_file (uint32_t epoch) {
+	const size_t len = strlen(journal.filename) + strlen(".tmp") + 1;
+	char* tmp_filename = calloc(len, sizeof(char));
+	if (!tmp_filename) {
+		return -1;
+	}
+	snprintf(tmp_filename, len, "%s.tmp", journal.filename);
+
+	int fd = open(tmp_filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("FAILED TO CREATE/OPEN JOURNAL FOR WRITING\n");
+		if (errno == EACCES) {
+			perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		free(tmp_filename);
+		return -1;
+	}
+
+	Journal_Header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	header.version = JOURNAL_VERSION;
+	header.epoch = epoch;
+	if (!write_fully(fd, &header, sizeof(header), -1) || fsync(fd) || rename(tmp_filename, journal.filename)) {
+		close(fd);
+		unlink(tmp_filename);
+		free(tmp_filename);
+		return -1;
+	}
+	sync_parent_directory(journal.filename);
+	free(tmp_filename);
+	return fd;
+}
+
+/*
+ * PURPOSE: Run every intact record of a journal through the command table and
+ *	cut the journal off after the last one
+ * INPUTS:
+ *	fd : File descriptor of the journal, positioned after the header
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: Number of replayed records
+ **/
+static unsigned int replay_records (int fd, Matrix_t** mats, unsigned int num_mats) {
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size <= (off_t) sizeof(Journal_Header_t)) {
+		return 0;
+	}
+	const size_t length = st.st_size - sizeof(Journal_Header_t);
+	char* records = malloc(length);
+	char* line = malloc(JOURNAL_MAX_LINE + 1);
+	if (!records || !line || pread(fd, records, length, sizeof(Journal_Header_t)) != (ssize_t) length) {
+		free(records);
+		free(line);
+		return 0;
+	}
+
+	unsigned int replayed = 0;
+	size_t offset = 0;
+	while (length - offset >= sizeof(Journal_Record_t)) {
+		Journal_Record_t record;
+		memcpy(&record, &records[offset], sizeof(record));
+		if (record.length == 0 || record.length > JOURNAL_MAX_LINE
+			|| record.length > length - offset - sizeof(record)
+			|| record_checksum(&records[offset + sizeof(record)], record.length) != record.checksum) {
+			break;
+		}
+		memcpy(line, &records[offset + sizeof(record)], record.length);
+		line[record.length] = '\0';
+		run_command_line(line, mats, num_mats);
+		offset += sizeof(record) + record.length;
+		replayed++;
+	}
+
+	if (offset < length) {
+		printf("Journal (%s) ends in %zu bytes of a torn record, dropped\n", journal.filename, length - offset);
+		if (ftruncate(fd, sizeof(Journal_Header_t) + offset) == 0) {
+			fsync(fd);
+		}
+	}
+	free(records);
+	free(line);
+	return replayed;
+}
+
+/*
+ * PURPOSE: FNV-1a checksum of a record
+ * INPUTS:
+ *	line : Pointer to the command line of the record
+ *	length : Length of the line
+ * RETURN: Checksum over the length and the line
+ **/
+static uint32_t record_checksum (const char* line, uint32_t length) {
+	uint32_t hash = 2166136261u;
+	for (unsigned int i = 0; i < sizeof(length); ++i) {
+		hash ^= (length >> (8 * i)) & 0xFF;
+		hash *= 16777619u;
+	}
+	for (uint32_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char) line[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * PURPOSE: Sync the directory holding a file so a rename into it is durable
+ * INPUTS:
+ *	filename : Path of the file
+ * RETURN: NONE
+ **/
+static void sync_parent_directory (const char* filename) {
+	const char* slash = strrchr(filename, '/');
+	char* directory = slash ? strndup(filename, slash == filename ? 1 : slash - filename) : strdup(".");
+	if (!directory) {
+		return;
+	}
+	int fd = open(directory, O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(directory);
+}
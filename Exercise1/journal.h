@@ -0,0 +1,36 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdint.h>
+
+#define JOURNAL_MAGIC "MJNL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_MAX_LINE 16384 // Longest command line that is journaled
+#define JOURNAL_CHECKPOINT_RECORDS 1024 // Records appended before the workspace is checkpointed
+
+/*
+ * On disk layout of a journal file:
+ *	Journal_Header_t
+ *	records, each Journal_Record_t followed by length bytes of command line
+ * The checkpoint workspace next to it (<journal>.ckpt) stores the epoch of the
+ * journal that continues from it, a journal with an older epoch is covered by
+ * the checkpoint already.
+ **/
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t epoch;
+	uint32_t reserved;
+}Journal_Header_t;
+
+typedef struct {
+	uint32_t length;
+	uint32_t checksum; // Over the length and the line, a torn record fails it
+}Journal_Record_t;
+
+bool open_journal (const char* journal_filename, Matrix_t** mats, unsigned int num_mats, bool* restored);
+bool start_journal (Matrix_t** mats, unsigned int num_mats);
+bool checkpoint_journal (Matrix_t** mats, unsigned int num_mats);
+void close_journal (void);
+
+#endif
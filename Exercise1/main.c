@@ -5,16 +5,80 @@
 #include <math.h>
 #include <stdbool.h>
 #include <time.h>
+#include <errno.h>
+#include <stdint.h>
 
 #include <readline/readline.h>
 
 #include "command.h"
 #include "matrix.h"
+#include "workspace.h"
+#include "csv.h"
+#include "pool.h"
+#include "batch.h"
+#include "journal.h"
+#include "share.h"
+#include "convolve.h"
 
-void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats);
-unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, 
-			const char* target);
 void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats);
+bool create_temp_matrix (Matrix_t** mats, unsigned int num_mats);
+
+bool display_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool add_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool duplicate_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool equal_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool shift_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool read_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool write_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool create_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool random_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool save_workspace_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool load_workspace_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool sum_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool view_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool materialize_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool import_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool export_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool convolve_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool share_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool attach_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool mem_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats);
+bool parse_slice (const char* text, unsigned int limit, unsigned int* start, unsigned int* end);
+bool parse_bound (const char* text, const char* stop, unsigned int* value);
+bool write_option_valid (const char* option);
+bool write_matrix_as_requested (Matrix_t* m, const char* option, unsigned int* tiles);
+bool shift_kernel (Batch_Item_t* item, const void* arg);
+bool write_kernel (Batch_Item_t* item, const void* arg);
+bool sum_kernel (Batch_Item_t* item, const void* arg);
+
+/*
+ * Every command of the application: name, min/max arguments, argument types,
+ * handler, whether the first matrix may be given as a name pattern, whether
+ * the command changes matrices and so goes into the journal and whether it
+ * reads outside input, which is checkpointed rather than journaled
+ */
+static const Command_Def_t command_defs[] = {
+	{"display", 1, 1, {ARG_MATRIX}, display_command},
+	{"add", 3, 3, {ARG_MATRIX, ARG_MATRIX, ARG_NAME}, add_command, false, true},
+	{"duplicate", 2, 2, {ARG_MATRIX, ARG_NAME}, duplicate_command, false, true},
+	{"equal", 2, 2, {ARG_MATRIX, ARG_MATRIX}, equal_command},
+	{"shift", 3, 3, {ARG_MATRIX, ARG_CHAR, ARG_SHIFT}, shift_command, true, true},
+	{"read", 1, 1, {ARG_FILE}, read_command, false, true, true},
+	{"write", 1, 2, {ARG_MATRIX, ARG_TEXT}, write_command, true},
+	{"create", 3, 3, {ARG_NAME, ARG_UINT, ARG_UINT}, create_command, false, true},
+	{"random", 3, 4, {ARG_MATRIX, ARG_UINT, ARG_UINT, ARG_UINT}, random_command, false, true},
+	{"save-workspace", 1, 1, {ARG_FILE}, save_workspace_command},
+	{"load-workspace", 1, 1, {ARG_FILE}, load_workspace_command, false, true, true},
+	{"sum", 1, 1, {ARG_MATRIX}, sum_command, true},
+	{"view", 3, 4, {ARG_NAME, ARG_TEXT, ARG_TEXT, ARG_TEXT}, view_command, false, true},
+	{"materialize", 2, 2, {ARG_MATRIX, ARG_NAME}, materialize_command, false, true},
+	{"import", 2, 2, {ARG_FILE, ARG_NAME}, import_command, false, true, true},
+	{"export", 2, 2, {ARG_MATRIX, ARG_FILE}, export_command},
+	{"convolve", 3, 4, {ARG_MATRIX, ARG_MATRIX, ARG_NAME, ARG_TEXT}, convolve_command, false, true},
+	{"share", 1, 1, {ARG_MATRIX}, share_command},
+	{"attach", 1, 1, {ARG_NAME}, attach_command, false, true, true},
+	{"mem", 0, 0, {ARG_TEXT}, mem_command},
+};
 
 /*
  * PURPOSE: Main function of program
@@ -24,294 +88,839 @@ void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats);
  * RETURN: NONE
  **/
 int main (int argc, char **argv) {
-	srand(time(NULL));		
+	srand(time(NULL));
 	char *line = NULL;
-	Commands_t* cmd;
 
 	Matrix_t *mats[10];
 	memset(&mats,0, sizeof(Matrix_t*) * 10); // IMPORTANT C FUNCTION TO LEARN
 
+	if (!init_command_table(command_defs, sizeof(command_defs) / sizeof(command_defs[0]))) {
+		perror("PROGRAM FAILED TO BUILD COMMAND TABLE\n");
+		return -1;
+	}
+
+	// Check for a workspace to restore or a journal to keep instead of the default temp_mat
+	const char* restore_filename = NULL;
+	const char* journal_filename = NULL;
+	if (argc == 3 && strncmp(argv[1], "--restore", strlen("--restore") + 1) == 0) {
+		restore_filename = argv[2];
+	}
+	else if (argc == 3 && strncmp(argv[1], "--journal", strlen("--journal") + 1) == 0) {
+		journal_filename = argv[2];
+	}
+	else if (argc != 1) {
+		printf("Usage: %s [--restore <workspace_file> | --journal <journal_file>]\n", argv[0]);
+		return -1;
+	}
+
+	if (journal_filename) {
+		bool restored = false;
+		if (!open_journal(journal_filename, mats, 10, &restored)
+			|| (!restored && !create_temp_matrix(mats, 10))
+			|| !start_journal(mats, 10)) {
+			close_journal();
+			destroy_command_cache();
+			destroy_remaining_heap_allocations(mats, 10);
+			perror("PROGRAM FAILED TO OPEN JOURNAL\n");
+			return -1;
+		}
+	}
+	else if (restore_filename) {
+		unsigned int loaded = 0;
+		if (!load_workspace(restore_filename, mats, 10, &loaded)) {
+			// Free allocated memory
+			destroy_remaining_heap_allocations(mats, 10);
+			perror("PROGRAM FAILED TO RESTORE WORKSPACE\n");
+			return -1;
+		}
+		printf("Workspace (%s) restored with %u matrices\n", restore_filename, loaded);
+	}
+	else if (!create_temp_matrix(mats, 10)) {
+		return -1;
+	}
+
+	line = readline("> ");
+	while (line && strncmp(line,"exit", strlen("exit")  + 1) != 0) {
+		run_command_line(line, mats, 10);
+		free(line);
+		line = readline("> ");
+	}
+	free(line);
+	close_journal();
+	destroy_command_cache();
+	destroy_remaining_heap_allocations(mats,10);
+
+	// Every matrix is gone, anything still live in the pool leaked
+	pool_drain();
+	if (pool_report_leaks() > 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * PURPOSE: Create the default temp_mat matrix, randomize it and write it out
+ * INPUTS:
+ *	mats : Pointer to Matrix_t array to add temp_mat to
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if temp_mat was created and written, else false
+ **/
+bool create_temp_matrix (Matrix_t** mats, unsigned int num_mats) {
 	Matrix_t *temp = NULL;
 
 	//Check for successful matrix creation
 	if(!create_matrix (&temp,"temp_mat", 5, 5) ) {
-		if(temp != NULL) {
-			free(temp);
-		}
-		return -1;
+		return false;
 	}
 
-	// Check for error 
-	if(0 > add_matrix_to_array(mats,temp, 10)) {
+	// Check for error
+	if(0 > add_matrix_to_array(mats,temp, num_mats)) {
 		// Free allocated memory
-		free(temp->data);
-		free(temp);
-		return -1;
+		destroy_matrix(&temp);
+		return false;
 	}
-	int mat_idx = find_matrix_given_name(mats,10,"temp_mat");
+	int mat_idx = find_matrix_given_name(mats,num_mats,"temp_mat");
 
 	if (mat_idx < 0) {
 		// Free allocated memory
-		destroy_remaining_heap_allocations(mats, 10);
+		destroy_remaining_heap_allocations(mats, num_mats);
 		perror("PROGRAM FAILED TO INIT\n");
-		return -1;
+		return false;
 	}
 	if(!random_matrix(mats[mat_idx], 10, 15)) {
 		// Free allocated memory
-		destroy_remaining_heap_allocations(mats, 10);
-		return -1;
+		destroy_remaining_heap_allocations(mats, num_mats);
+		return false;
 	}
 	if(!write_matrix("temp_mat", mats[mat_idx])) {
 		// Free allocated memory
-		destroy_remaining_heap_allocations(mats, 10);
-		return -1;
+		destroy_remaining_heap_allocations(mats, num_mats);
+		return false;
 	}
+	return true;
+}
 
-	line = readline("> ");
-	while (strncmp(line,"exit", strlen("exit")  + 1) != 0) {
-		
-		if (!parse_user_input(line,&cmd)) {
-			printf("Failed at parsing command\n\n");
-		}
-		
-		if (cmd->num_cmds > 1) {	
-			run_commands(cmd,mats,10);
-		}
-		if (line) {
-			free(line);
-		}
-		destroy_commands(&cmd);
-		line = readline("> ");
+/*
+ * PURPOSE: Print a matrix
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool display_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	display_matrix (plan->args[0].mat);
+	return true;
+}
+
+/*
+ * PURPOSE: Add two matrices into a newly created matrix
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, matrix, result name)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool add_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* a = plan->args[0].mat;
+	Matrix_t* b = plan->args[1].mat;
+	Matrix_t* c = NULL;
+	if( !create_matrix_for_overwrite (&c,plan->args[2].text, a->rows, a->cols)) {
+		printf("Failure to create the result Matrix (%s)\n", plan->args[2].text);
+		return false;
 	}
-	free(line);
-	destroy_remaining_heap_allocations(mats,10);
-	return 0;	
+
+	// Add before storing the result, storing it may evict one of the operands
+	if (! add_matrices(a, b, c) ) {
+		printf("Failure to add %s with %s into %s\n", a->name, b->name, c->name);
+		destroy_matrix(&c);
+		return false;
+	}
+	printf ("Addition of %s and %s finished and is stored in %s\n", a->name, b->name, c->name);
+
+	if(0 > add_matrix_to_array(mats,c, num_mats)) {
+		// Failed to add matrix to array
+		printf("Failure to add newly allocated matrix to array\n");
+		destroy_matrix(&c);
+		return false;
+	}
+	return true;
 }
 
 /*
- * PURPOSE: Run user inputted commands
+ * PURPOSE: Copy a matrix into a newly created matrix
  * INPUTS:
- *	cmd : Pointer to Commands_t to run
+ *	plan : Pointer to Command_Plan_t with args (matrix, copy name)
  *	mats : Pointer to Matrix_t array
  *	num_mats : Number of matrices in mats array
- * RETURN: NONE
+ * RETURN: True if the command succeeded, else false
  **/
-void run_commands (Commands_t* cmd, Matrix_t** mats, unsigned int num_mats) {
-	// Check parameters
-	if(!cmd || !mats) {
-		return;
+bool duplicate_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* src = plan->args[0].mat;
+	Matrix_t* dup_mat = NULL;
+	if( !create_matrix_for_overwrite (&dup_mat,plan->args[1].text, src->rows, src->cols)) {
+		printf("Duplication Failed\n");
+		return false;
+	}
+	if(!duplicate_matrix (src, dup_mat)) {
+		// Failed to duplicate matrix
+		printf("Failure to duplicate matrix\n");
+		destroy_matrix(&dup_mat);
+		return false;
 	}
+	printf ("Duplication of %s into %s finished\n", src->name, dup_mat->name);
 
-	/*Parsing and calling of commands*/
-	if (strncmp(cmd->cmds[0],"display",strlen("display") + 1) == 0
-		&& cmd->num_cmds == 2) {
-			/*find the requested matrix*/
-			int idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-			if (idx >= 0) {
-				display_matrix (mats[idx]);
+	if(0 > add_matrix_to_array(mats,dup_mat,num_mats)) {
+		// Failed to add new matrix to array
+		printf("Failure to add newly allocated matrix to array\n");
+		destroy_matrix(&dup_mat);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Compare the contents of two matrices
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, matrix)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool equal_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	if ( equal_matrices(plan->args[0].mat, plan->args[1].mat) ) {
+		printf("SAME DATA IN BOTH\n");
+	}
+	else {
+		printf("DIFFERENT DATA IN BOTH\n");
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Bitwise shift every element of a matrix
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, direction, shifts)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool shift_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	const unsigned int shift_value = plan->args[2].value;
+	if (plan->num_matches > 0) {
+		Batch_Item_t* items = NULL;
+		if (!run_batch(plan->matches, plan->num_matches, shift_kernel, plan, &items)) {
+			printf("Matrix shift failed\n");
+			return false;
+		}
+		unsigned int shifted = 0;
+		for (unsigned int i = 0; i < plan->num_matches; ++i) {
+			if (items[i].success) {
+				shifted++;
 			}
 			else {
-				printf("Matrix (%s) doesn't exist\n", cmd->cmds[1]);
-				return;
+				printf("Matrix shift failed for (%s)\n", items[i].mat->name);
 			}
+		}
+		printf("%u of %u matrices matching (%s) have been shifted by %u\n", shifted,
+			plan->num_matches, plan->args[0].text, shift_value);
+		free(items);
+		// Replaying the line shifts the same matrices again
+		return shifted > 0;
 	}
-	else if (strncmp(cmd->cmds[0],"add",strlen("add") + 1) == 0
-		&& cmd->num_cmds == 4) {
-			int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-			int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
-			if (mat1_idx >= 0 && mat2_idx >= 0) {
-				Matrix_t* c = NULL;
-				if( !create_matrix (&c,cmd->cmds[3], mats[mat1_idx]->rows, 
-						mats[mat1_idx]->cols)) {
-					printf("Failure to create the result Matrix (%s)\n", cmd->cmds[3]);
-					return;
-				}
-			
-				if(0 > add_matrix_to_array(mats,c, num_mats)) {
-					// Failed to add matrix to array
-					printf("Failure to add newly allocated matrix to array\n");
-					
-					// Free newly allocated array
-					free(c->data);
-					free(c);
-					return;
-				}
-
-
-				if (! add_matrices(mats[mat1_idx], mats[mat2_idx],c) ) {
-					printf("Failure to add %s with %s into %s\n", mats[mat1_idx]->name, mats[mat2_idx]->name, c->name);
-					return;	
-				}
-
-				printf ("Addition of %s and %s finished and is stored in %s\n", mats[mat1_idx]->name, mats[mat2_idx]->name, c->name);
-			}
+
+	Matrix_t* m = plan->args[0].mat;
+	if(!bitwise_shift_matrix(m, plan->args[1].value, shift_value)) {
+		// Check for successful bit shift
+		printf("Matrix shift failed\n");
+		return false;
 	}
-	else if (strncmp(cmd->cmds[0],"duplicate",strlen("duplicate") + 1) == 0
-		&& cmd->num_cmds == 3 && strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if (mat1_idx >= 0 ) {
-				Matrix_t* dup_mat = NULL;
-				if( !create_matrix (&dup_mat,cmd->cmds[2], mats[mat1_idx]->rows, 
-						mats[mat1_idx]->cols)) {
-					return;
-				}
-				if(!duplicate_matrix (mats[mat1_idx], dup_mat)) {
-					// Failed to duplicate matrix
-					printf("Failure to duplicate matrix\n");
-					
-					// Free newly allocated array
-					free(dup_mat->data);
-					free(dup_mat);
-					return;
-				} 
-				if(0 > add_matrix_to_array(mats,dup_mat,num_mats)) {
-					// Failed to add new matrix to array
-					printf("Failure to add newly allocated matrix to array\n");
-					
-					// Free newly allocated array
-					free(dup_mat->data);
-					free(dup_mat);
-					return;
-				}
-				printf ("Duplication of %s into %s finished\n", mats[mat1_idx]->name, cmd->cmds[2]);
-		}
-		else {
-			printf("Duplication Failed\n");
-			return;
-		}
+	printf("Matrix (%s) has been shifted by %u\n", m->name, shift_value);
+	return true;
+}
+
+/*
+ * PURPOSE: Read a matrix from the filesystem into the array
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (filename)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool read_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* new_matrix = NULL;
+	if(! read_matrix(plan->args[0].text,&new_matrix)) {
+		printf("Read Failed\n");
+		return false;
+	}
+
+	if(0 > add_matrix_to_array(mats,new_matrix, num_mats)) {
+		// Failed to add new matrix to array
+		printf("Failed to add new matrix to array!");
+		destroy_matrix(&new_matrix);
+		return false;
+	}
+	printf("Matrix (%s) is read from the filesystem\n", plan->args[0].text);
+	return true;
+}
+
+/*
+ * PURPOSE: Write a matrix to the filesystem under its own name, with "update"
+ *	only the parts changed since the last write are written into the file and
+ *	with a directory ending in '/' the file is put in that directory
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, optional "update" or directory)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool write_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	const char* option = plan->num_args == 2 ? plan->args[1].text : NULL;
+	if (!write_option_valid(option)) {
+		printf("Usage: write <matrix_name> [update | <directory>/]\n");
+		return false;
 	}
-	else if (strncmp(cmd->cmds[0],"equal",strlen("equal") + 1) == 0
-		&& cmd->num_cmds == 3) {
-			int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-			int mat2_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[2]);
-			if (mat1_idx >= 0 && mat2_idx >= 0) {
-				if ( equal_matrices(mats[mat1_idx],mats[mat2_idx]) ) {
-					printf("SAME DATA IN BOTH\n");
-				}
-				else {
-					printf("DIFFERENT DATA IN BOTH\n");
-				}
+	const bool update = option && strncmp(option, "update", strlen("update") + 1) == 0;
+
+	if (plan->num_matches > 0) {
+		Batch_Item_t* items = NULL;
+		if (!run_batch(plan->matches, plan->num_matches, write_kernel, option, &items)) {
+			printf("Write Failed\n");
+			return false;
+		}
+		unsigned int written = 0;
+		unsigned int tiles = 0;
+		for (unsigned int i = 0; i < plan->num_matches; ++i) {
+			if (items[i].success) {
+				written++;
+				tiles += items[i].value;
+				// Namesakes are written one after another, each one forgets the file the others wrote
+				unsync_namesakes(mats, num_mats, items[i].mat);
 			}
 			else {
-				printf("Equal Failed\n");
-				return;
+				printf("Write Failed for (%s)\n", items[i].mat->name);
 			}
-	}
-	else if (strncmp(cmd->cmds[0],"shift",strlen("shift") + 1) == 0
-		&& cmd->num_cmds == 4) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		const int shift_value = atoi(cmd->cmds[3]);
-		if (mat1_idx >= 0 ) {
-			if(!bitwise_shift_matrix(mats[mat1_idx],cmd->cmds[2][0], shift_value)) {
-				// Check for successful bit shift
-				printf("Matrix shift failed\n");
-				return;
-			}
-			printf("Matrix (%s) has been shifted by %d\n", mats[mat1_idx]->name, shift_value);
+		}
+		if (update) {
+			printf("%u of %u matrices matching (%s) are updated on the filesystem, %u tiles written\n",
+				written, plan->num_matches, plan->args[0].text, tiles);
 		}
 		else {
-			printf("Matrix shift failed\n");
-			return;
+			printf("%u of %u matrices matching (%s) are wrote out to %s\n", written, plan->num_matches,
+				plan->args[0].text, option ? option : "the filesystem");
 		}
+		free(items);
+		return written > 0;
+	}
 
+	Matrix_t* m = plan->args[0].mat;
+	unsigned int tiles = 0;
+	if (!write_matrix_as_requested(m, option, &tiles)) {
+		printf("Write Failed\n");
+		return false;
 	}
-	else if (strncmp(cmd->cmds[0],"read",strlen("read") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		Matrix_t* new_matrix = NULL;
-		if(! read_matrix(cmd->cmds[1],&new_matrix)) {
-			printf("Read Failed\n");
-			return;
-		}	
-		
-		if(0 > add_matrix_to_array(mats,new_matrix, num_mats)) {
-			// Failed to add new matrix to array
-			printf("Failed to add new matrix to array!");
-			// Free new matrix
-			free(new_matrix);
-			return;
-		} 
-		printf("Matrix (%s) is read from the filesystem\n", cmd->cmds[1]);	
-	}
-	else if (strncmp(cmd->cmds[0],"write",strlen("write") + 1) == 0
-		&& cmd->num_cmds == 2) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if(! write_matrix(mats[mat1_idx]->name,mats[mat1_idx])) {
-			printf("Write Failed\n");
-			return;
+	unsync_namesakes(mats, num_mats, m);
+	if (update) {
+		printf("Matrix (%s) is updated on the filesystem, %u tiles written\n", m->name, tiles);
+	}
+	else {
+		printf("Matrix (%s) is wrote out to %s\n", m->name, option ? option : "the filesystem");
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Create a new zeroed matrix in the array
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (name, rows, cols)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool create_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* new_mat = NULL;
+	const unsigned int rows = plan->args[1].value;
+	const unsigned int cols = plan->args[2].value;
+
+	if(!create_matrix(&new_mat,plan->args[0].text,rows, cols)) {
+		// Failed to create new matrix
+		printf("Failed to create new matrix\n");
+		destroy_matrix(&new_mat);
+		return false;
+	}
+	if(0 > add_matrix_to_array(mats,new_mat,num_mats)) {
+		// Failed to add new matrix to array
+		printf("Failed to add new matrix to array\n");
+		destroy_matrix(&new_mat);
+		return false;
+	}
+	printf("Created Matrix (%s,%u,%u)\n", new_mat->name, new_mat->rows, new_mat->cols);
+	return true;
+}
+
+/*
+ * PURPOSE: Fill a matrix with random values in a range. Without a seed one is
+ *	picked and journaled with the command, so a replay draws the same values.
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, start range, end range, optional seed)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool random_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* m = plan->args[0].mat;
+	const unsigned int start_range = plan->args[1].value;
+	const unsigned int end_range = plan->args[2].value;
+	const unsigned int seed = plan->num_args == 4 ? plan->args[3].value : (unsigned int) rand();
+	if (plan->num_args == 3) {
+		const size_t len = strlen("random") + MATRIX_NAME_LEN + 3 * 11 + 4;
+		plan->journal_line = calloc(len, sizeof(char));
+		if (plan->journal_line) {
+			snprintf(plan->journal_line, len, "random %s %u %u %u", m->name, start_range, end_range, seed);
 		}
-		else {
-			printf("Matrix (%s) is wrote out to the filesystem\n", mats[mat1_idx]->name);
+	}
+	srand(seed);
+	if(!random_matrix(m,start_range, end_range)) {
+		// Failed to init random values
+		printf("Failed to load random values into matrix\n");
+		return false;
+	}
+
+	printf("Matrix (%s) is randomized between %u %u\n", m->name, start_range, end_range);
+	return true;
+}
+
+/*
+ * PURPOSE: Save every matrix into one workspace file
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (filename)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool save_workspace_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	if (!save_workspace(plan->args[0].text, mats, num_mats, 0)) {
+		printf("Workspace save failed\n");
+		return false;
+	}
+	printf("Workspace is saved to (%s)\n", plan->args[0].text);
+	return true;
+}
+
+/*
+ * PURPOSE: Load every matrix of a workspace file into the array
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (filename)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool load_workspace_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	unsigned int loaded = 0;
+	if (!load_workspace(plan->args[0].text, mats, num_mats, &loaded)) {
+		printf("Workspace load failed\n");
+		return false;
+	}
+	printf("Workspace (%s) is loaded with %u matrices\n", plan->args[0].text, loaded);
+	return true;
+}
+
+/*
+ * PURPOSE: Print the sum of every element of a matrix
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool sum_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	if (plan->num_matches > 0) {
+		Batch_Item_t* items = NULL;
+		if (!run_batch(plan->matches, plan->num_matches, sum_kernel, NULL, &items)) {
+			printf("Sum Failed\n");
+			return false;
 		}
+		unsigned int total = 0;
+		printf("Sum of %u matrices matching (%s):\n", plan->num_matches, plan->args[0].text);
+		for (unsigned int i = 0; i < plan->num_matches; ++i) {
+			printf("  %-25s %u\n", items[i].mat->name, items[i].value);
+			total += items[i].value;
+		}
+		printf("  %-25s %u\n", "total", total);
+		free(items);
+		return true;
 	}
-	else if (strncmp(cmd->cmds[0], "create", strlen("create") + 1) == 0
-		&& strlen(cmd->cmds[1]) + 1 <= MATRIX_NAME_LEN && cmd->num_cmds == 4) {
-		Matrix_t* new_mat = NULL;
-		const unsigned int rows = atoi(cmd->cmds[2]);
-		const unsigned int cols = atoi(cmd->cmds[3]);
-
-		if(!create_matrix(&new_mat,cmd->cmds[1],rows, cols)) {
-			// Failed to create new matrix
-			printf("Failed to create new matrix");
-			if(new_mat) {
-				free(new_mat);
-			}
-			return;
+
+	Matrix_t* m = plan->args[0].mat;
+	printf("Sum of Matrix (%s) is %u\n", m->name, (unsigned int) sum_matrix(m));
+	return true;
+}
+
+/*
+ * PURPOSE: Create a view into a region of a matrix, e.g. view V = A[0:2, 1:3]
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (view name, "=", region...)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool view_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	if (strncmp(plan->args[1].text, "=", strlen("=") + 1) != 0) {
+		printf("Usage: view <view_name> = <matrix_name>[r0:r1, c0:c1]\n");
+		return false;
+	}
+
+	// The region may have been split on the space after the comma
+	char spec[MATRIX_NAME_LEN + 4 * 10 + 8]; // name[r0:r1, c0:c1] with ten digit bounds
+	if (snprintf(spec, sizeof(spec), "%s%s", plan->args[2].text,
+		plan->num_args == 4 ? plan->args[3].text : "") >= (int) sizeof(spec)) {
+		printf("Usage: view <view_name> = <matrix_name>[r0:r1, c0:c1]\n");
+		return false;
+	}
+
+	char* open_bracket = strchr(spec, '[');
+	char* comma = strchr(spec, ',');
+	char* close_bracket = strchr(spec, ']');
+	if (!open_bracket || !comma || !close_bracket || comma < open_bracket
+		|| close_bracket < comma || close_bracket[1] != '\0') {
+		printf("Usage: view <view_name> = <matrix_name>[r0:r1, c0:c1]\n");
+		return false;
+	}
+	*open_bracket = '\0';
+	*comma = '\0';
+	*close_bracket = '\0';
+
+	int idx = find_matrix_given_name(mats, num_mats, spec);
+	if (idx < 0) {
+		printf("Matrix (%s) doesn't exist\n", spec);
+		return false;
+	}
+	Matrix_t* src = mats[idx];
+
+	unsigned int row_start, row_end, col_start, col_end;
+	if (!parse_slice(open_bracket + 1, src->rows, &row_start, &row_end)
+		|| !parse_slice(comma + 1, src->cols, &col_start, &col_end)) {
+		printf("Invalid region for Matrix (%s,%u,%u)\n", src->name, src->rows, src->cols);
+		return false;
+	}
+
+	Matrix_t* view = NULL;
+	if (!create_view(&view, plan->args[0].text, src, row_start, row_end, col_start, col_end)) {
+		printf("Failed to create view\n");
+		return false;
+	}
+	if (0 > add_matrix_to_array(mats, view, num_mats)) {
+		printf("Failed to add new matrix to array\n");
+		destroy_matrix(&view);
+		return false;
+	}
+	printf("View (%s,%u,%u) of %s created\n", view->name, view->rows, view->cols, view->parent->name);
+	return true;
+}
+
+/*
+ * PURPOSE: Copy a matrix or view into a new compact matrix
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, new name)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool materialize_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* src = plan->args[0].mat;
+	Matrix_t* dest = NULL;
+	if (!materialize_matrix(src, plan->args[1].text, &dest)) {
+		printf("Materialize Failed\n");
+		return false;
+	}
+	printf("Matrix (%s) is materialized into %s\n", src->name, dest->name);
+
+	if (0 > add_matrix_to_array(mats, dest, num_mats)) {
+		printf("Failed to add new matrix to array\n");
+		destroy_matrix(&dest);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * PURPOSE: Import a comma separated text file as a new matrix
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (filename, new name)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool import_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* new_matrix = NULL;
+	if (!import_csv(plan->args[0].text, plan->args[1].text, &new_matrix)) {
+		printf("Import Failed\n");
+		return false;
+	}
+	if (0 > add_matrix_to_array(mats, new_matrix, num_mats)) {
+		printf("Failed to add new matrix to array\n");
+		destroy_matrix(&new_matrix);
+		return false;
+	}
+	printf("Matrix (%s,%u,%u) is imported from %s\n", new_matrix->name, new_matrix->rows,
+		new_matrix->cols, plan->args[0].text);
+	return true;
+}
+
+/*
+ * PURPOSE: Export a matrix as a comma separated text file
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, filename)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool export_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* m = plan->args[0].mat;
+	if (!export_csv(plan->args[1].text, m)) {
+		printf("Export Failed\n");
+		return false;
+	}
+	printf("Matrix (%s) is exported to %s\n", m->name, plan->args[1].text);
+	return true;
+}
+
+/*
+ * PURPOSE: Convolve a matrix with a kernel matrix into a new matrix
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix, kernel, new name, optional border)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool convolve_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Border_Mode_t border = BORDER_ZERO;
+	if (plan->num_args == 4 && !parse_border_mode(plan->args[3].text, &border)) {
+		printf("Usage: convolve <matrix_name> <kernel_matrix_name> <dest_matrix_name> [zero | clamp | wrap]\n");
+		return false;
+	}
+	Matrix_t* src = plan->args[0].mat;
+	Matrix_t* dest = NULL;
+	if (!convolve_matrix(src, plan->args[1].mat, border, plan->args[2].text, &dest)) {
+		printf("Convolve Failed\n");
+		return false;
+	}
+	if (0 > add_matrix_to_array(mats, dest, num_mats)) {
+		printf("Failed to add new matrix to array\n");
+		destroy_matrix(&dest);
+		return false;
+	}
+	printf("Matrix (%s) is convolved with %s into %s\n", src->name, plan->args[1].mat->name, dest->name);
+	return true;
+}
+
+/*
+ * PURPOSE: Move a matrix into shared memory so other processes can attach it
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (matrix)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool share_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* m = plan->args[0].mat;
+	if (!share_matrix(m)) {
+		printf("Share Failed\n");
+		return false;
+	}
+	printf("Matrix (%s) is shared as %s\n", m->name, m->share->segment);
+	return true;
+}
+
+/*
+ * PURPOSE: Attach a matrix another process shared, read-only and without copying
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t with args (shared name)
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool attach_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	Matrix_t* new_matrix = NULL;
+	if (!attach_matrix(plan->args[0].text, &new_matrix)) {
+		printf("Attach Failed\n");
+		return false;
+	}
+	if (0 > add_matrix_to_array(mats, new_matrix, num_mats)) {
+		printf("Failed to add new matrix to array\n");
+		destroy_matrix(&new_matrix);
+		return false;
+	}
+	printf("Matrix (%s,%u,%u) is attached read-only\n", new_matrix->name, new_matrix->rows,
+		new_matrix->cols);
+	return true;
+}
+
+/*
+ * PURPOSE: Print how much memory the matrices hold and how the buffer pool is doing
+ * INPUTS:
+ *	plan : Pointer to Command_Plan_t without args
+ *	mats : Pointer to Matrix_t array
+ *	num_mats : Number of matrices in mats array
+ * RETURN: True if the command succeeded, else false
+ **/
+bool mem_command (Command_Plan_t* plan, Matrix_t** mats, unsigned int num_mats) {
+	for (unsigned int i = 0; i < num_mats; ++i) {
+		Matrix_t* m = mats[i];
+		if (!m) {
+			continue;
+		}
+		if (m->parent) {
+			printf("%-25s %10u x %-10u view of %s\n", m->name, m->rows, m->cols, m->parent->name);
+		}
+		else if (m->mapping) {
+			printf("%-25s %10u x %-10u %zu bytes mapped from workspace\n", m->name, m->rows, m->cols,
+				(size_t) m->rows * m->cols * sizeof(unsigned int));
 		}
-		if(0 > add_matrix_to_array(mats,new_mat,num_mats)) {
-			// Failed to add new matrix to array
-			printf("Failed to add new matrix to array");
-			// Free newly allocated memory
-			free(new_mat->data);
-			free(new_mat);
-			return;
+		else if (m->share) {
+			printf("%-25s %10u x %-10u %zu bytes %s %s\n", m->name, m->rows, m->cols,
+				(size_t) m->rows * m->cols * sizeof(unsigned int),
+				m->read_only ? "attached read-only from" : "shared as", m->share->segment);
 		}
-		printf("Created Matrix (%s,%u,%u)\n", new_mat->name, new_mat->rows, new_mat->cols);
-	}
-	else if (strncmp(cmd->cmds[0], "random", strlen("random") + 1) == 0
-		&& cmd->num_cmds == 4) {
-		int mat1_idx = find_matrix_given_name(mats,num_mats,cmd->cmds[1]);
-		if(0 > mat1_idx) {
-			// Failed to find matrix
-			return;
+		else if (m->packed) {
+			printf("%-25s %10u x %-10u %zu bytes packed from %zu\n", m->name, m->rows, m->cols,
+				pool_buffer_size(m->packed), (size_t) m->rows * m->cols * sizeof(unsigned int));
 		}
-		const unsigned int start_range = atoi(cmd->cmds[2]);
-		const unsigned int end_range = atoi(cmd->cmds[3]);
-		if(!random_matrix(mats[mat1_idx],start_range, end_range)) {
-			// Failed to init random values
-			printf("Failed to load random values into matrix");
+		else {
+			printf("%-25s %10u x %-10u %zu bytes\n", m->name, m->rows, m->cols, pool_buffer_size(m->data));
 		}
+	}
 
-		printf("Matrix (%s) is randomized between %u %u\n", mats[mat1_idx]->name, start_range, end_range);
+	Pool_Stats_t stats;
+	pool_stats(&stats);
+	printf("Live: %zu bytes in %u buffers, peak %zu bytes\n", stats.live_bytes, stats.live_buffers,
+		stats.peak_bytes);
+	printf("Pool: %zu bytes in %u cached buffers, %lu of %lu allocations reused a buffer\n",
+		stats.cached_bytes, stats.cached_buffers, stats.reused, stats.allocations);
+	return true;
+}
+
+/*
+ * PURPOSE: Parse one start:end range of a view region, either bound may be
+ *	left out to mean the start or the end of the dimension
+ * INPUTS:
+ *	text : Range text such as "1:3", ":3" or ":"
+ *	limit : Size of the dimension the range is in
+ *	start : Pointer to store the first index in
+ *	end : Pointer to store one past the last index in
+ * RETURN: True if the range is valid and not empty, else false
+ **/
+bool parse_slice (const char* text, unsigned int limit, unsigned int* start, unsigned int* end) {
+	char* colon = strchr(text, ':');
+	if (!colon) {
+		return false;
 	}
-	else {
-		printf("Not a command in this application\n");
+
+	*start = 0;
+	*end = limit;
+	if (text != colon && !parse_bound(text, colon, start)) {
+		return false;
 	}
+	if (colon[1] != '\0' && !parse_bound(colon + 1, colon + strlen(colon), end)) {
+		return false;
+	}
+	return *start < *end && *end <= limit;
+}
 
+/*
+ * PURPOSE: Parse one bound of a view range, digits only up to stop
+ * INPUTS:
+ *	text : Start of the bound
+ *	stop : Where the bound must end
+ *	value : Pointer to store the bound in
+ * RETURN: True if the bound is a decimal number that fits 32 bits, else false
+ **/
+bool parse_bound (const char* text, const char* stop, unsigned int* value) {
+	// strtoul would take a sign or leading spaces and wrap negative numbers
+	if (*text < '0' || *text > '9') {
+		return false;
+	}
+	char* parse_end = NULL;
+	errno = 0;
+	const unsigned long parsed = strtoul(text, &parse_end, 10);
+	if (parse_end != stop || errno || parsed > UINT32_MAX) {
+		return false;
+	}
+	*value = parsed;
+	return true;
 }
 
 /*
- * PURPOSE: Find matrix by name in array
+ * PURPOSE: Check the optional argument of the write command
  * INPUTS:
- *	mats : Pointer to array of Matrix_t to free
- *	num_mats : Size of mats array
- *	target : String of name to find
- * RETURN: Index of the found matrix in array, if not found then -1 is returned
+ *	option : NULL, "update" or a directory ending in '/'
+ * RETURN: True if the option is one of those, else false
  **/
-unsigned int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, const char* target) {
-	//Parameter check
-	if(!mats || !(*mats) || !target) {
-		return -1;
+bool write_option_valid (const char* option) {
+	if (!option) {
+		return true;
 	}
+	const size_t len = strlen(option);
+	return strncmp(option, "update", strlen("update") + 1) == 0 || (len > 0 && option[len - 1] == '/');
+}
 
-	for (int i = 0; i < num_mats; ++i) {
-		if(!mats[i]) {
-			break;
-		}
-		if (strncmp(mats[i]->name,target,strlen(mats[i]->name)) == 0) {
-			return i;
-		}
+/*
+ * PURPOSE: Write a matrix under its own name, updated in place, or into a directory
+ * INPUTS:
+ *	m : Pointer to Matrix_t to write
+ *	option : NULL, "update" or a directory ending in '/'
+ *	tiles : Pointer to store the number of tiles written by an update in
+ * RETURN: True if the file was written, else false
+ **/
+bool write_matrix_as_requested (Matrix_t* m, const char* option, unsigned int* tiles) {
+	*tiles = 0;
+	if (!option) {
+		return write_matrix(m->name, m);
+	}
+	if (strncmp(option, "update", strlen("update") + 1) == 0) {
+		return update_matrix_file(m->name, m, tiles);
+	}
+
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s%s", option, m->name) >= (int) sizeof(path)) {
+		return false;
 	}
-	return -1;
+	return write_matrix(path, m);
+}
+
+/*
+ * PURPOSE: Batch kernel of the shift command
+ * INPUTS:
+ *	item : Pointer to Batch_Item_t of the matrix to shift
+ *	arg : Pointer to the Command_Plan_t with args (pattern, direction, shifts)
+ * RETURN: True if the matrix was shifted, else false
+ **/
+bool shift_kernel (Batch_Item_t* item, const void* arg) {
+	const Command_Plan_t* plan = arg;
+	return bitwise_shift_matrix(item->mat, plan->args[1].value, plan->args[2].value);
+}
+
+/*
+ * PURPOSE: Batch kernel of the write command, the tile count goes in item->value
+ * INPUTS:
+ *	item : Pointer to Batch_Item_t of the matrix to write
+ *	arg : The write option, NULL, "update" or a directory
+ * RETURN: True if the matrix was written, else false
+ **/
+bool write_kernel (Batch_Item_t* item, const void* arg) {
+	return write_matrix_as_requested(item->mat, arg, &item->value);
+}
+
+/*
+ * PURPOSE: Batch kernel of the sum command, the sum goes in item->value
+ * INPUTS:
+ *	item : Pointer to Batch_Item_t of the matrix to sum
+ *	arg : Unused
+ * RETURN: True
+ **/
+bool sum_kernel (Batch_Item_t* item, const void* arg) {
+	item->value = sum_matrix(item->mat);
+	return true;
 }
 
 /*
@@ -329,15 +938,9 @@ void destroy_remaining_heap_allocations(Matrix_t **mats, unsigned int num_mats)
 
 	int i;
 
-	// Free all matrices in array 
+	// Free all matrices in array
 	for(i = 0; i < num_mats; i++) {
-		if(mats[i]) {
-			if(mats[i]->data) {
-				// Free data
-				free(mats[i]->data);
-			}
-			// Free structure
-			free(mats[i]);
-		}
+		// Free data and structure
+		destroy_matrix(&mats[i]);
 	}
 }
@@ -11,12 +11,34 @@
 
 
 #include "matrix.h"
+#include "workspace.h"
+#include "pool.h"
+#include "packed.h"
+#include "share.h"
+#include "util.h"
 
 
 #define MAX_CMD_COUNT 50
 
 /*protected functions*/
+static bool get_file_id (int fd, Matrix_File_Id_t* id);
+static bool same_file_id (const Matrix_File_Id_t* a, const Matrix_File_Id_t* b);
 void load_matrix (Matrix_t* m, unsigned int* data);
+static bool allocate_matrix (Matrix_t** new_matrix, const char* name, unsigned int rows,
+			unsigned int cols, bool zero);
+static void mark_rows_dirty (Matrix_t* m, unsigned int row_start, unsigned int row_end);
+static void clear_dirty_tiles (Matrix_t* m);
+static unsigned int count_tiles (const Matrix_t* m);
+static unsigned int header_length (const Matrix_t* m);
+static bool allocate_row_scratch (const Matrix_t* m, unsigned int** scratch);
+static bool begin_matrix_write (Matrix_t* m);
+static void end_matrix_write (Matrix_t* m);
+static void copy_matrix_data (const Matrix_t* src, Matrix_t* dest);
+
+/* Bumped every time a slot of the matrix array changes, starts at one */
+static unsigned long array_generation = 1;
+/* Counts additions to the matrix array, the next slot to fill is this modulo its size */
+static unsigned long array_position = 0;
 
 /* 
  * PURPOSE: instantiates a new matrix with the passed name, rows, cols 
@@ -32,52 +54,70 @@ void load_matrix (Matrix_t* m, unsigned int* data);
 
 bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows,
 						const unsigned int cols) {
-	// Check parameters
-	if(!new_matrix || !name) {
-		return false;
-	} else if((rows == 0) || (cols == 0)) {
-		return false;
-	}
-
-	// Allocate Matrix_t structure
-	*new_matrix = calloc(1,sizeof(Matrix_t));
-	if (!(*new_matrix)) {
-		return false;
-	}
-	
-	// Allocate the data for the matrix
-	(*new_matrix)->data = calloc(rows * cols,sizeof(unsigned int));
-	if (!(*new_matrix)->data) {
-		return false;
-	}
-	
-	// Set values
-	(*new_matrix)->rows = rows;
-	(*new_matrix)->cols = cols;
-	unsigned int len = strlen(name) + 1; 
-	if (len > MATRIX_NAME_LEN) {
-		return false;
-	}
-	strncpy((*new_matrix)->name,name,len);
-	return true;
+	return allocate_matrix(new_matrix, name, rows, cols, true);
+}
 
+/* 
+ * PURPOSE: instantiates a new matrix like create_matrix but leaves the data
+ *	uninitialized, for callers that overwrite every element straight away
+ * INPUTS: 
+ *	name the name of the matrix limited to 50 characters 
+ *  rows the number of rows the matrix
+ *  cols the number of cols the matrix
+ * RETURN:
+ *  If no errors occurred during instantiation then true
+ *  else false for an error in the process.
+ *
+ **/
+bool create_matrix_for_overwrite (Matrix_t** new_matrix, const char* name, const unsigned int rows,
+						const unsigned int cols) {
+	return allocate_matrix(new_matrix, name, rows, cols, false);
 }
 
 /* 
- * PURPOSE: Frees memory associated with Matrix supplied
+ * PURPOSE: Frees memory associated with Matrix supplied. A matrix with live
+ *	views is only marked released, its last view frees it.
  * INPUTS: 
  *	m : Pointer to the Matrix_t pointer desired to have memory freed
  * RETURN: NONE
  **/
 void destroy_matrix (Matrix_t** m) {
 	//Check parameter
-	if(!m || !(*m) || !((*m)->data)) {
+	if(!m || !(*m)) {
 		return;
 	}
 
-	free((*m)->data);
+	if ((*m)->views > 0) {
+		// Views still point into the buffer
+		(*m)->released = true;
+		*m = NULL;
+		return;
+	}
+
+	Matrix_t* parent = (*m)->parent;
+	if (parent) {
+		// Data belongs to the parent
+		parent->views--;
+	}
+	else if ((*m)->mapping) {
+		// Data belongs to a mapped workspace file
+		release_workspace_mapping((*m)->mapping);
+	}
+	else if ((*m)->share) {
+		// Data lives in a shared memory segment
+		release_share((*m)->share);
+	}
+	else {
+		pool_free((*m)->data);
+		pool_free((*m)->packed);
+	}
+	free((*m)->dirty_tiles);
 	free(*m);
 	*m = NULL;
+
+	if (parent && parent->released && parent->views == 0) {
+		destroy_matrix(&parent);
+	}
 }
 
 /* 
@@ -89,15 +129,31 @@ void destroy_matrix (Matrix_t** m) {
  **/
 bool equal_matrices (Matrix_t* a, Matrix_t* b) {
 	// Check parameters
-	if (!a || !b || !a->data || !b->data) {
+	if (!a || !b || !MATRIX_HAS_DATA(a) || !MATRIX_HAS_DATA(b)) {
 		return false;	
 	}
+	if (a->rows != b->rows || a->cols != b->cols) {
+		return false;
+	}
+	if (a->packed && b->packed) {
+		// Compare the encodings, nothing is decoded
+		return equal_packed(a->packed, b->packed);
+	}
 
-	int result = memcmp(a->data,b->data, sizeof(unsigned int) * a->rows * a->cols);
-	if (result == 0) {
-		return true;
+	unsigned int* a_scratch = NULL;
+	unsigned int* b_scratch = NULL;
+	if (!allocate_row_scratch(a, &a_scratch) || !allocate_row_scratch(b, &b_scratch)) {
+		free(a_scratch);
+		return false;
 	}
-	return false;
+	bool equal = true;
+	for (unsigned int i = 0; equal && i < a->rows; ++i) {
+		equal = memcmp(matrix_row(a, i, a_scratch), matrix_row(b, i, b_scratch),
+			sizeof(unsigned int) * a->cols) == 0;
+	}
+	free(a_scratch);
+	free(b_scratch);
+	return equal;
 }
 
 /* 
@@ -109,15 +165,40 @@ bool equal_matrices (Matrix_t* a, Matrix_t* b) {
  **/
 bool duplicate_matrix (Matrix_t* src, Matrix_t* dest) {
 	// Check parameters
-	if (!src || !dest || !src->data || !dest->data) {
+	if (!src || !dest || !MATRIX_HAS_DATA(src) || !MATRIX_HAS_DATA(dest)) {
+		return false;
+	}
+	if (src->rows != dest->rows || src->cols != dest->cols) {
+		return false;
+	}
+	if (src == dest) {
+		return true;
+	}
+	if (!unpack_matrix_for_overwrite(dest) || !begin_matrix_write(dest)) {
 		return false;
 	}
+
 	/*
-	 * copy over data
+	 * An attached source can be written by its owner at any time, copy it
+	 * again until the copy did not overlap a write
 	 */
-	unsigned int bytesToCopy = sizeof(unsigned int) * src->rows * src->cols;
-	memcpy(dest->data,src->data, bytesToCopy);	
-	return equal_matrices (src,dest);
+	const Matrix_t* src_owner = src->parent ? src->parent : src;
+	for (unsigned int attempt = 0; ; ++attempt) {
+		const uint32_t sequence = src_owner->read_only ? share_read_begin(src_owner->share->header) : 0;
+		copy_matrix_data(src, dest);
+		if (!src_owner->read_only || !share_read_retry(src_owner->share->header, sequence)) {
+			break;
+		}
+		if (attempt == SHARE_MAX_RETRIES) {
+			printf("SHARED MATRIX (%s) IS BUSY\n", src_owner->name);
+			end_matrix_write(dest);
+			return false;
+		}
+	}
+	end_matrix_write(dest);
+	mark_rows_dirty(dest, 0, dest->rows);
+	// The owner of an attached source may have changed it again by now
+	return src_owner->read_only || equal_matrices (src,dest);
 }
 
 /* 
@@ -131,19 +212,23 @@ bool duplicate_matrix (Matrix_t* src, Matrix_t* dest) {
 bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
 	
 	// Check parameters
-	if (!a || !a->data) {
+	if (!a || !MATRIX_HAS_DATA(a) || shift >= 32) {
 		return false;
 	} else if((direction != 'l') && (direction != 'r')) {
 		return false;
 	}
+	if (!unpack_matrix(a) || !begin_matrix_write(a)) {
+		return false;
+	}
 
 	// Left shift
 	if (direction == 'l') {
 		unsigned int i = 0;
 		for (; i < a->rows; ++i) {
+			unsigned int* row = &a->data[i * a->stride];
 			unsigned int j = 0;
 			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] << shift;
+				row[j] = row[j] << shift;
 			}
 		}
 
@@ -151,13 +236,16 @@ bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
 	else { // Right shift
 		unsigned int i = 0;
 		for (; i < a->rows; ++i) {
+			unsigned int* row = &a->data[i * a->stride];
 			unsigned int j = 0;
 			for (; j < a->cols; ++j) {
-				a->data[i * a->cols + j] = a->data[i * a->cols + j] >> shift;
+				row[j] = row[j] >> shift;
 			}
 		}
 	}
 	
+	end_matrix_write(a);
+	mark_rows_dirty(a, 0, a->rows);
 	return true;
 }
 
@@ -172,21 +260,69 @@ bool bitwise_shift_matrix (Matrix_t* a, char direction, unsigned int shift) {
 bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
 
 	// Check parameters
-	if(!a || !b || !c || !a->data || !b->data || !c->data) {
+	if(!a || !b || !c || !MATRIX_HAS_DATA(a) || !MATRIX_HAS_DATA(b) || !MATRIX_HAS_DATA(c)) {
+		return false;
+	}
+	if (a->rows != b->rows || a->cols != b->cols
+		|| a->rows != c->rows || a->cols != c->cols) {
+		return false;
+	}
+	// Packed inputs are decoded a row at a time, the result is always plain
+	if (!unpack_matrix(c)) {
 		return false;
 	}
-	if (a->rows != b->rows && a->cols != b->cols) {
+	unsigned int* a_scratch = NULL;
+	unsigned int* b_scratch = NULL;
+	if (!allocate_row_scratch(a, &a_scratch) || !allocate_row_scratch(b, &b_scratch)) {
+		free(a_scratch);
+		return false;
+	}
+	if (!begin_matrix_write(c)) {
+		free(a_scratch);
+		free(b_scratch);
 		return false;
 	}
 
-	for (int i = 0; i < a->rows; ++i) {
-		for (int j = 0; j < b->cols; ++j) {
-			c->data[i * a->cols +j] = a->data[i * a->cols + j] + b->data[i * a->cols + j];
+	for (unsigned int i = 0; i < a->rows; ++i) {
+		const unsigned int* a_row = matrix_row(a, i, a_scratch);
+		const unsigned int* b_row = matrix_row(b, i, b_scratch);
+		unsigned int* c_row = &c->data[i * c->stride];
+		for (unsigned int j = 0; j < a->cols; ++j) {
+			c_row[j] = a_row[j] + b_row[j];
 		}
 	}
+	free(a_scratch);
+	free(b_scratch);
+	end_matrix_write(c);
+	mark_rows_dirty(c, 0, c->rows);
 	return true;
 }
 
+/* 
+ * PURPOSE: Sum every element of a matrix
+ * INPUTS: 
+ *	m : Pointer to Matrix_t to sum
+ * RETURN: Sum of all elements, wrapping like the unsigned elements do
+ **/
+int sum_matrix (Matrix_t* m) {
+	// Check parameter
+	if(!m || !MATRIX_HAS_DATA(m)) {
+		return 0;
+	}
+	if (m->packed) {
+		return sum_packed(m->packed);
+	}
+
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < m->rows; ++i) {
+		const unsigned int* row = &m->data[i * m->stride];
+		for (unsigned int j = 0; j < m->cols; ++j) {
+			sum += row[j];
+		}
+	}
+	return sum;
+}
+
 /* 
  * PURPOSE: Print contents of matrix
  * INPUTS: 
@@ -196,20 +332,113 @@ bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c) {
 void display_matrix (Matrix_t* m) {
 	
 	// Check parameter
-	if(!m || !m->data) {
+	if(!m || !MATRIX_HAS_DATA(m)) {
+		return;
+	}
+	unsigned int* scratch = NULL;
+	if (!allocate_row_scratch(m, &scratch)) {
 		return;
 	}
 
 	printf("\nMatrix Contents (%s):\n", m->name);
 	printf("DIM = (%u,%u)\n", m->rows, m->cols);
 	for (int i = 0; i < m->rows; ++i) {
+		const unsigned int* row = matrix_row(m, i, scratch);
 		for (int j = 0; j < m->cols; ++j) {
-			printf("%u ", m->data[i * m->cols + j]);
+			printf("%u ", row[j]);
 		}
 		printf("\n");
 	}
 	printf("\n");
+	free(scratch);
+
+}
+
+/* 
+ * PURPOSE: Create a view of a rectangular region of a matrix. The view shares
+ *	the source buffer, nothing is copied and changes go through to the source.
+ * INPUTS: 
+ *	view : Pointer to Matrix_t pointer to store the view in
+ *	name : Name of the view
+ *	src : Pointer to Matrix_t to view into, may itself be a view
+ *	row_start : First row of the region
+ *	row_end : One past the last row of the region
+ *	col_start : First column of the region
+ *	col_end : One past the last column of the region
+ * RETURN: True if the view was created, else false
+ **/
+bool create_view (Matrix_t** view, const char* name, Matrix_t* src, unsigned int row_start,
+			unsigned int row_end, unsigned int col_start, unsigned int col_end) {
+	// Check parameters
+	if (!view || !name || !src || !MATRIX_HAS_DATA(src)) {
+		return false;
+	}
+	if (row_start >= row_end || row_end > src->rows || col_start >= col_end || col_end > src->cols) {
+		return false;
+	}
+	const unsigned int len = strlen(name) + 1;
+	if (len > MATRIX_NAME_LEN) {
+		return false;
+	}
 
+	// Views always hang off the buffer owner so no chains of views build up
+	Matrix_t* owner = src->parent ? src->parent : src;
+	if (!unpack_matrix(owner)) {
+		return false;
+	}
+
+	*view = calloc(1, sizeof(Matrix_t));
+	if (!(*view)) {
+		return false;
+	}
+	strncpy((*view)->name, name, len);
+	(*view)->rows = row_end - row_start;
+	(*view)->cols = col_end - col_start;
+	(*view)->stride = src->stride;
+	(*view)->data = &src->data[row_start * src->stride + col_start];
+	(*view)->parent = owner;
+	owner->views++;
+	return true;
+}
+
+/* 
+ * PURPOSE: Create a compact copy of a matrix or view
+ * INPUTS: 
+ *	src : Pointer to Matrix_t to copy
+ *	name : Name of the new matrix
+ *	dest : Pointer to Matrix_t pointer to store the copy in
+ * RETURN: True if the copy was created, else false
+ **/
+bool materialize_matrix (Matrix_t* src, const char* name, Matrix_t** dest) {
+	// Check parameters
+	if (!src || !name || !dest) {
+		return false;
+	}
+
+	if (!create_matrix_for_overwrite(dest, name, src->rows, src->cols)) {
+		return false;
+	}
+	if (!duplicate_matrix(src, *dest)) {
+		destroy_matrix(dest);
+		return false;
+	}
+	return true;
+}
+
+/* 
+ * PURPOSE: Get one row of a matrix whether it is plain or packed
+ * INPUTS: 
+ *	m : Pointer to Matrix_t to read
+ *	row : Index of the row
+ *	scratch : Pointer to room for one row, used when the matrix is packed
+ * RETURN: Pointer to the row elements, into the matrix or into scratch
+ **/
+const unsigned int* matrix_row (const Matrix_t* m, unsigned int row, unsigned int* scratch) {
+	if (!m->packed) {
+		return &m->data[(size_t) row * m->stride];
+	}
+	decode_packed_range(m->packed, (size_t) row * m->cols, m->cols, scratch);
+	return scratch;
 }
 
 /* 
@@ -263,9 +492,15 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 		else if (errno == EEXIST) {
 			perror("FILE EXIST\n");
 		}
+		close(fd);
+		return false;
+	}
+	if (name_len == 0 || name_len > MATRIX_NAME_LEN) {
+		printf("MATRIX NAME LENGTH IN FILE IS INVALID\n");
+		close(fd);
 		return false;
 	}
-	char name_buffer[50];
+	char name_buffer[MATRIX_NAME_LEN];
 	if (read (fd,name_buffer,sizeof(char) * name_len) != sizeof(char) * name_len) {
 		printf("FAILED TO READ MATRIX NAME\n");
 		if (errno == EACCES ) {
@@ -281,8 +516,10 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 			perror("FILE EXIST\n");
 		}
 
+		close(fd);
 		return false;	
 	}
+	name_buffer[name_len - 1] = '\0';
 
 	if (read (fd,&rows, sizeof(unsigned int)) != sizeof(unsigned int)) {
 		printf("FAILED TO READ MATRIX ROW SIZE\n");
@@ -299,6 +536,7 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 			perror("FILE EXIST\n");
 		}
 
+		close(fd);
 		return false;
 	}
 
@@ -317,12 +555,18 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 			perror("FILE EXIST\n");
 		}
 
+		close(fd);
+		return false;
+	}
+
+	/* Read the data straight into the new matrix, no need to zero it first */
+	if (!create_matrix_for_overwrite(m,name_buffer,rows,cols)) {
+		close(fd);
 		return false;
 	}
 
-	unsigned int numberOfDataBytes = rows * cols * sizeof(unsigned int);
-	unsigned int *data = calloc(rows * cols, sizeof(unsigned int));
-	if (read(fd,data,numberOfDataBytes) != numberOfDataBytes) {
+	ssize_t numberOfDataBytes = (ssize_t) rows * cols * sizeof(unsigned int);
+	if (read(fd,(*m)->data,numberOfDataBytes) != numberOfDataBytes) {
 		printf("FAILED TO READ MATRIX DATA\n");
 		if (errno == EACCES ) {
 			perror("DO NOT HAVE ACCESS TO FILE\n");
@@ -337,19 +581,17 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 			perror("FILE EXIST\n");
 		}
 
+		close(fd);
+		destroy_matrix(m);
 		return false;	
 	}
 
-	if (!create_matrix(m,name_buffer,rows,cols)) {
-		return false;
-	}
-
-	load_matrix(*m,data);
-	free(data);
 	if (close(fd)) {
+		destroy_matrix(m);
 		return false;
 
 	}
+	pack_matrix(*m);
 	return true;
 }
 
@@ -363,7 +605,11 @@ bool read_matrix (const char* matrix_input_filename, Matrix_t** m) {
 bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
 	
 	//Check parameter
-	if(!matrix_output_filename || !m || !m->data) {
+	if(!matrix_output_filename || !m || !MATRIX_HAS_DATA(m)) {
+		return false;
+	}
+	unsigned int* scratch = NULL;
+	if (!allocate_row_scratch(m, &scratch)) {
 		return false;
 	}
 
@@ -383,29 +629,53 @@ bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
 		else if (errno == EEXIST) {
 			perror("FILE EXISTS\n");
 		}
+		free(scratch);
 		return false;
 	}
-	/* Calculate the needed buffer for our matrix */
-	unsigned int name_len = strlen(m->name) + 1;
-	unsigned int numberOfBytes = sizeof(unsigned int) + (sizeof(unsigned int)  * 2) + name_len + sizeof(unsigned int) * m->rows * m->cols + 1;
-	/* Allocate the output_buffer in bytes
-	 * IMPORTANT TO UNDERSTAND THIS WAY OF MOVING MEMORY
-	 */
-	unsigned char* output_buffer = calloc(numberOfBytes,sizeof(unsigned char));
-	unsigned int offset = 0;
-	memcpy(&output_buffer[offset], &name_len, sizeof(unsigned int)); // IMPORTANT C FUNCTION TO KNOW
-	offset += sizeof(unsigned int);	
-	memcpy(&output_buffer[offset], m->name,name_len);
-	offset += name_len;
-	memcpy(&output_buffer[offset],&m->rows,sizeof(unsigned int));
+	// The old contents are gone, whatever happens below
+	const bool own_file = !m->parent && strncmp(matrix_output_filename, m->name, MATRIX_NAME_LEN) == 0;
+	if (own_file) {
+		m->synced = false;
+	}
+	/* Header first, then the rows straight from the matrix, no copy of the whole matrix is made */
+	const unsigned int name_len = strlen(m->name) + 1;
+	const unsigned int header_len = header_length(m);
+	unsigned char* header = malloc(header_len);
+	if (!header) {
+		free(scratch);
+		close(fd);
+		return false;
+	}
+	size_t offset = 0;
+	memcpy(&header[offset], &name_len, sizeof(unsigned int)); // IMPORTANT C FUNCTION TO KNOW
 	offset += sizeof(unsigned int);
-	memcpy(&output_buffer[offset],&m->cols,sizeof(unsigned int));
+	memcpy(&header[offset], m->name, name_len);
+	offset += name_len;
+	memcpy(&header[offset], &m->rows, sizeof(unsigned int));
 	offset += sizeof(unsigned int);
-	memcpy (&output_buffer[offset],m->data,m->rows * m->cols * sizeof(unsigned int));
-	offset += (m->rows * m->cols * sizeof(unsigned int));
-	output_buffer[numberOfBytes - 1] = EOF;
+	memcpy(&header[offset], &m->cols, sizeof(unsigned int));
+	bool written = write_fully(fd, header, header_len, 0);
+	free(header);
+
+	const size_t row_bytes = (size_t) m->cols * sizeof(unsigned int);
+	offset = header_len;
+	if (written && m->data && m->stride == m->cols) {
+		// Contiguous plain data goes out in one piece
+		written = write_fully(fd, m->data, row_bytes * m->rows, offset);
+		offset += row_bytes * m->rows;
+	}
+	else {
+		for (unsigned int i = 0; written && i < m->rows; ++i) {
+			// Row by row so views are written compacted and packed rows decoded
+			written = write_fully(fd, matrix_row(m, i, scratch), row_bytes, offset);
+			offset += row_bytes;
+		}
+	}
+	const unsigned char end = EOF;
+	written = written && write_fully(fd, &end, sizeof(end), offset);
+	free(scratch);
 
-	if (write(fd,output_buffer,numberOfBytes) != numberOfBytes) {
+	if (!written) {
 		printf("FAILED TO WRITE MATRIX TO FILE\n");
 		if (errno == EACCES ) {
 			perror("DO NOT HAVE ACCESS TO FILE\n");
@@ -419,14 +689,134 @@ bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
 		else if (errno == EEXIST) {
 			perror("FILE EXIST\n");
 		}
+		close(fd);
 		return false;
 	}
-	
+
+	const bool identified = own_file && get_file_id(fd, &m->synced_file);
 	if (close(fd)) {
 		return false;
 	}
-	free(output_buffer);
 
+	// The file now matches the buffer, later changes can be written in place
+	if (identified) {
+		clear_dirty_tiles(m);
+		m->synced = true;
+	}
+	return true;
+}
+
+/* 
+ * PURPOSE: Write only the tiles of a matrix changed since its last write into
+ *	the existing file named after it, falling back to a full write when the
+ *	file is missing, does not match the matrix, was written by anyone else
+ *	since the last sync or the buffer was never synced
+ * INPUTS: 
+ *	matrix_output_filename : filename to update, must be the matrix name
+ *	m : Pointer to Matrix_t to write to file
+ *	tiles_written : Pointer to store the number of tiles written in, may be NULL
+ * RETURN: True if the file matches the matrix afterwards, else false
+ **/
+bool update_matrix_file (const char* matrix_output_filename, Matrix_t* m, unsigned int* tiles_written) {
+	//Check parameter
+	if(!matrix_output_filename || !m || !MATRIX_HAS_DATA(m)) {
+		return false;
+	}
+	const unsigned int num_tiles = count_tiles(m);
+	if (tiles_written) {
+		*tiles_written = num_tiles;
+	}
+
+	if (!m->synced || m->parent || strncmp(matrix_output_filename, m->name, MATRIX_NAME_LEN) != 0) {
+		return write_matrix(matrix_output_filename, m);
+	}
+
+	int fd = open(matrix_output_filename, O_RDWR);
+	if (fd < 0) {
+		return write_matrix(matrix_output_filename, m);
+	}
+
+	/* Only update the very file this matrix last wrote, holding exactly this matrix, header included */
+	const unsigned int header_len = header_length(m);
+	unsigned char* header = calloc(header_len, sizeof(unsigned char));
+	unsigned char* expected = calloc(header_len, sizeof(unsigned char));
+	Matrix_File_Id_t id;
+	bool compatible = header && expected && get_file_id(fd, &id) && same_file_id(&id, &m->synced_file)
+		&& id.size == (off_t) header_len + (off_t) m->rows * m->cols * sizeof(unsigned int) + 1
+		&& pread(fd, header, header_len, 0) == header_len;
+	if (compatible) {
+		unsigned int name_len = strlen(m->name) + 1;
+		memcpy(&expected[0], &name_len, sizeof(unsigned int));
+		memcpy(&expected[sizeof(unsigned int)], m->name, name_len);
+		memcpy(&expected[sizeof(unsigned int) + name_len], &m->rows, sizeof(unsigned int));
+		memcpy(&expected[2 * sizeof(unsigned int) + name_len], &m->cols, sizeof(unsigned int));
+		compatible = memcmp(header, expected, header_len) == 0;
+	}
+	free(header);
+	free(expected);
+	if (!compatible) {
+		close(fd);
+		return write_matrix(matrix_output_filename, m);
+	}
+
+	/* Write each run of consecutive dirty tiles with a single pwrite */
+	const size_t total_elems = (size_t) m->rows * m->cols;
+	unsigned int written = 0;
+	unsigned int* scratch = NULL;
+	if (m->packed) {
+		// Packed tiles are decoded one at a time before writing
+		scratch = malloc(MATRIX_TILE_ELEMS * sizeof(unsigned int));
+	}
+	bool success = !m->packed || scratch;
+	for (unsigned int tile = 0; success && tile < num_tiles; ) {
+		if (!m->dirty_tiles || !(m->dirty_tiles[tile / 8] & (1 << (tile % 8)))) {
+			tile++;
+			continue;
+		}
+		unsigned int run_end = tile + 1;
+		while (run_end < num_tiles && (m->dirty_tiles[run_end / 8] & (1 << (run_end % 8)))) {
+			run_end++;
+		}
+		const size_t first = (size_t) tile * MATRIX_TILE_ELEMS;
+		size_t last = (size_t) run_end * MATRIX_TILE_ELEMS;
+		if (last > total_elems) {
+			last = total_elems;
+		}
+		for (size_t pos = first; success && pos < last; ) {
+			const size_t count = m->packed && last - pos > MATRIX_TILE_ELEMS ? MATRIX_TILE_ELEMS : last - pos;
+			const unsigned int* src = scratch;
+			if (m->packed) {
+				decode_packed_range(m->packed, pos, count, scratch);
+			}
+			else {
+				src = &m->data[pos];
+			}
+			const size_t bytes = count * sizeof(unsigned int);
+			if (pwrite(fd, src, bytes, header_len + pos * sizeof(unsigned int)) != (ssize_t) bytes) {
+				printf("FAILED TO WRITE MATRIX TO FILE\n");
+				success = false;
+			}
+			pos += count;
+		}
+		written += run_end - tile;
+		tile = run_end;
+	}
+
+	free(scratch);
+	// Our own writes changed the file times, remember the file as it is now
+	success = success && get_file_id(fd, &m->synced_file);
+	if (close(fd)) {
+		success = false;
+	}
+	if (!success) {
+		// The file is in an unknown state now
+		m->synced = false;
+		return false;
+	}
+	clear_dirty_tiles(m);
+	if (tiles_written) {
+		*tiles_written = written;
+	}
 	return true;
 }
 
@@ -441,19 +831,249 @@ bool write_matrix (const char* matrix_output_filename, Matrix_t* m) {
 bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range) {
 	
 	//Check parameter
-	if(!m || !m->data) {
+	if(!m || !MATRIX_HAS_DATA(m) || end_range < start_range) {
+		return false;
+	}
+	if (!unpack_matrix_for_overwrite(m) || !begin_matrix_write(m)) {
 		return false;
 	}
+	// In 64 bits, the full range 0..4294967295 spans 2^32 values
+	const uint64_t span = (uint64_t) end_range + 1 - start_range;
 	for (unsigned int i = 0; i < m->rows; ++i) {
 		for (unsigned int j = 0; j < m->cols; ++j) {
-			m->data[i * m->cols + j] = rand() % (end_range + 1 - start_range) + start_range;
+			m->data[(size_t) i * m->stride + j] = rand() % span + start_range;
 		}
 	}
+	end_matrix_write(m);
+	mark_rows_dirty(m, 0, m->rows);
+	// Narrow ranges pack well, pack_matrix leaves the matrix alone otherwise
+	pack_matrix(m);
 	return true;
 }
 
 /*Protected Functions in C*/
 
+/* 
+ * PURPOSE: Allocate a Matrix_t and its data buffer from the matrix buffer pool
+ * INPUTS: 
+ *	new_matrix : Pointer to Matrix_t pointer to store the matrix in
+ *	name : Name of the matrix
+ *	rows : Number of rows
+ *	cols : Number of columns
+ *	zero : True to zero the data, false if the caller overwrites all of it
+ * RETURN: True if the matrix was allocated, else false
+ **/
+static bool allocate_matrix (Matrix_t** new_matrix, const char* name, unsigned int rows,
+			unsigned int cols, bool zero) {
+	// Check parameters
+	if(!new_matrix || !name) {
+		return false;
+	} else if((rows == 0) || (cols == 0)) {
+		return false;
+	}
+
+	unsigned int len = strlen(name) + 1; 
+	if (len > MATRIX_NAME_LEN) {
+		return false;
+	}
+
+	// Allocate Matrix_t structure
+	*new_matrix = calloc(1,sizeof(Matrix_t));
+	if (!(*new_matrix)) {
+		return false;
+	}
+
+	// Allocate the data for the matrix
+	(*new_matrix)->data = pool_alloc((size_t) rows * cols * sizeof(unsigned int), zero);
+	if (!(*new_matrix)->data) {
+		destroy_matrix(new_matrix);
+		return false;
+	}
+	
+	// Set values
+	(*new_matrix)->rows = rows;
+	(*new_matrix)->cols = cols;
+	(*new_matrix)->stride = cols;
+	strncpy((*new_matrix)->name,name,len);
+	return true;
+}
+
+/* 
+ * PURPOSE: Mark the tiles covering a range of rows as changed. Views mark the
+ *	tiles of their buffer owner, nothing is tracked until a matrix is synced.
+ * INPUTS: 
+ *	m : Pointer to Matrix_t that changed
+ *	row_start : First changed row
+ *	row_end : One past the last changed row
+ * RETURN: NONE
+ **/
+static void mark_rows_dirty (Matrix_t* m, unsigned int row_start, unsigned int row_end) {
+	Matrix_t* owner = m->parent ? m->parent : m;
+	if (!owner->synced || row_start >= row_end) {
+		return;
+	}
+	if (!owner->dirty_tiles) {
+		owner->dirty_tiles = calloc((count_tiles(owner) + 7) / 8, sizeof(unsigned char));
+		if (!owner->dirty_tiles) {
+			// Without tracking the next update has to rewrite everything
+			owner->synced = false;
+			return;
+		}
+	}
+
+	const size_t base = m->data - owner->data;
+	const bool contiguous = m->cols == m->stride;
+	for (unsigned int i = row_start; i < row_end; ++i) {
+		const size_t first = base + (size_t) i * m->stride;
+		size_t last = first + m->cols - 1;
+		if (contiguous) {
+			last = base + (size_t) (row_end - 1) * m->stride + m->cols - 1;
+			i = row_end;
+		}
+		for (size_t tile = first / MATRIX_TILE_ELEMS; tile <= last / MATRIX_TILE_ELEMS; ++tile) {
+			owner->dirty_tiles[tile / 8] |= 1 << (tile % 8);
+		}
+	}
+}
+
+/* 
+ * PURPOSE: Forget all recorded changes of a matrix
+ * INPUTS: 
+ *	m : Pointer to Matrix_t to clear
+ * RETURN: NONE
+ **/
+static void clear_dirty_tiles (Matrix_t* m) {
+	if (m->dirty_tiles) {
+		memset(m->dirty_tiles, 0, (count_tiles(m) + 7) / 8);
+	}
+}
+
+/* 
+ * PURPOSE: Count the dirty tracking tiles of a buffer owner
+ * INPUTS: 
+ *	m : Pointer to Matrix_t owning its buffer
+ * RETURN: Number of tiles
+ **/
+static unsigned int count_tiles (const Matrix_t* m) {
+	return ((size_t) m->rows * m->cols + MATRIX_TILE_ELEMS - 1) / MATRIX_TILE_ELEMS;
+}
+
+/* 
+ * PURPOSE: Size of the header write_matrix puts in front of the data
+ * INPUTS: 
+ *	m : Pointer to Matrix_t written
+ * RETURN: Header length in bytes
+ **/
+static unsigned int header_length (const Matrix_t* m) {
+	return sizeof(unsigned int) + strlen(m->name) + 1 + sizeof(unsigned int) * 2;
+}
+
+/*
+ * PURPOSE: Take the identity of an open file
+ * INPUTS:
+ *	fd : File descriptor of the file
+ *	id : Pointer to Matrix_File_Id_t to fill
+ * RETURN: True unless fstat failed
+ **/
+static bool get_file_id (int fd, Matrix_File_Id_t* id) {
+	struct stat st;
+	if (fstat(fd, &st)) {
+		return false;
+	}
+	id->dev = st.st_dev;
+	id->ino = st.st_ino;
+	id->size = st.st_size;
+	id->mtime = st.st_mtim;
+	return true;
+}
+
+/*
+ * PURPOSE: Compare two file identities
+ * INPUTS:
+ *	a : Pointer to the first Matrix_File_Id_t
+ *	b : Pointer to the second Matrix_File_Id_t
+ * RETURN: True if both describe the same file in the same state, else false
+ **/
+static bool same_file_id (const Matrix_File_Id_t* a, const Matrix_File_Id_t* b) {
+	return a->dev == b->dev && a->ino == b->ino && a->size == b->size
+		&& a->mtime.tv_sec == b->mtime.tv_sec && a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+/* 
+ * PURPOSE: Allocate room for one decoded row when a matrix is packed
+ * INPUTS: 
+ *	m : Pointer to Matrix_t to be read with matrix_row
+ *	scratch : Pointer to store the buffer in, NULL when m is plain
+ * RETURN: True unless the allocation failed
+ **/
+static bool allocate_row_scratch (const Matrix_t* m, unsigned int** scratch) {
+	*scratch = NULL;
+	if (!m->packed) {
+		return true;
+	}
+	*scratch = malloc(m->cols * sizeof(unsigned int));
+	return *scratch != NULL;
+}
+
+/* 
+ * PURPOSE: Check that a matrix may be written and enter the write section of
+ *	its shared segment, if it has one
+ * INPUTS: 
+ *	m : Pointer to Matrix_t about to be written
+ * RETURN: True if the write may go ahead, false for attached matrices
+ **/
+static bool begin_matrix_write (Matrix_t* m) {
+	Matrix_t* owner = m->parent ? m->parent : m;
+	if (owner->read_only) {
+		printf("Matrix (%s) is attached read-only\n", m->name);
+		return false;
+	}
+	if (owner->share) {
+		share_write_begin(owner->share);
+	}
+	return true;
+}
+
+/* 
+ * PURPOSE: Leave the write section entered by begin_matrix_write
+ * INPUTS: 
+ *	m : Pointer to Matrix_t that was written
+ * RETURN: NONE
+ **/
+static void end_matrix_write (Matrix_t* m) {
+	Matrix_t* owner = m->parent ? m->parent : m;
+	if (owner->share) {
+		share_write_end(owner->share);
+	}
+}
+
+/* 
+ * PURPOSE: Copy the elements of one matrix into another of the same shape,
+ *	one row at a time when either side is a view
+ * INPUTS: 
+ *	src : Pointer to Matrix_t to copy from, may be packed
+ *	dest : Pointer to plain Matrix_t to copy into
+ * RETURN: NONE
+ **/
+static void copy_matrix_data (const Matrix_t* src, Matrix_t* dest) {
+	if (src->packed && dest->stride == dest->cols) {
+		decode_packed_range(src->packed, 0, (size_t) src->rows * src->cols, dest->data);
+	}
+	else if (src->packed) {
+		for (unsigned int i = 0; i < src->rows; ++i) {
+			matrix_row(src, i, &dest->data[i * dest->stride]);
+		}
+	}
+	else if (src->stride == src->cols && dest->stride == dest->cols) {
+		memcpy(dest->data,src->data, sizeof(unsigned int) * src->rows * src->cols);
+	}
+	else {
+		for (unsigned int i = 0; i < src->rows; ++i) {
+			memcpy(&dest->data[i * dest->stride], &src->data[i * src->stride], sizeof(unsigned int) * src->cols);
+		}
+	}
+}
+
 /* 
  * PURPOSE: Load data into Matrix_t
  * INPUTS: 
@@ -463,10 +1083,15 @@ bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range
  **/
 void load_matrix (Matrix_t* m, unsigned int* data) {
 	// Check parameters
-	if(!m || !m->data || !data) {
+	if(!m || !MATRIX_HAS_DATA(m) || !data) {
+		return;
+	}
+	if (!unpack_matrix_for_overwrite(m) || !begin_matrix_write(m)) {
 		return;
 	}
 	memcpy(m->data,data,m->rows * m->cols * sizeof(unsigned int));
+	end_matrix_write(m);
+	mark_rows_dirty(m, 0, m->rows);
 }
 
 /* 
@@ -478,8 +1103,7 @@ void load_matrix (Matrix_t* m, unsigned int* data) {
  * RETURN: The array index one after the new matrix position, else returns -1
  **/
 unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigned int num_mats) {
-	static long int current_position = 0;
-	const long int pos = current_position % num_mats;
+	const long int pos = array_position % num_mats;
 
 	// Check parameters
 	if(!mats || !new_matrix) {
@@ -490,6 +1114,75 @@ unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigne
 		destroy_matrix(&mats[pos]);
 	} 
 	mats[pos] = new_matrix;
-	current_position++;
+	array_position++;
+	array_generation++;
 	return pos;
 }
+
+/*
+ * PURPOSE: Find matrix by name in array
+ * INPUTS:
+ *	mats : Pointer to array of Matrix_t to search
+ *	num_mats : Size of mats array
+ *	target : String of name to find
+ * RETURN: Index of the found matrix in array, if not found then -1 is returned
+ **/
+int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, const char* target) {
+	//Parameter check
+	if(!mats || !target) {
+		return -1;
+	}
+
+	for (int i = 0; i < num_mats; ++i) {
+		if(!mats[i]) {
+			continue;
+		}
+		if (strncmp(mats[i]->name,target,MATRIX_NAME_LEN) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * PURPOSE: Forget that the other matrices of the same name match the file
+ *	named after them, once one of them has written it
+ * INPUTS:
+ *	mats : Array of Matrix_t pointers
+ *	num_mats : Size of mats array
+ *	written : Pointer to the Matrix_t that wrote the file
+ * RETURN: NONE
+ **/
+void unsync_namesakes (Matrix_t** mats, unsigned int num_mats, const Matrix_t* written) {
+	// Check parameters
+	if (!mats || !written) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < num_mats; ++i) {
+		if (mats[i] && mats[i] != written && strncmp(mats[i]->name, written->name, MATRIX_NAME_LEN) == 0) {
+			mats[i]->synced = false;
+		}
+	}
+}
+
+/*
+ * PURPOSE: Report the current generation of the matrix array, so callers
+ *	holding Matrix_t pointers can tell whether they may have gone stale
+ * INPUTS: NONE
+ * RETURN: Generation counter, changes whenever a matrix is added or replaced
+ **/
+unsigned long matrix_array_generation (void) {
+	return array_generation;
+}
+
+/*
+ * PURPOSE: Find the slot add_matrix_to_array fills next, which holds the oldest
+ *	matrix once the array is full
+ * INPUTS:
+ *	num_mats : Size of the matrix array
+ * RETURN: Index of the next slot to fill
+ **/
+unsigned int matrix_array_oldest (unsigned int num_mats) {
+	return array_position % num_mats;
+}
@@ -2,17 +2,49 @@
 #define _MATRIX_H_
 
 #define MATRIX_NAME_LEN 25
+#define MATRIX_TILE_ELEMS 16384 // Elements per dirty tile, 64 KiB of data
 
+#include <sys/types.h>
+#include <time.h>
+
+struct Workspace_Map;
+struct Packed_Matrix;
+struct Share_Map;
+
+/* Identity of a file as it was last synced, it changes when anyone else writes the file */
 typedef struct {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+}Matrix_File_Id_t;
+
+/* True when the matrix holds elements, plain or bit-packed */
+#define MATRIX_HAS_DATA(m) ((m)->data || (m)->packed)
+
+typedef struct Matrix {
 	char name[MATRIX_NAME_LEN];
 	unsigned int rows;
 	unsigned int cols;
+	unsigned int stride; // Elements from the start of one row to the next
 	unsigned int *data;
+	struct Workspace_Map *mapping; // Set when data lives in a mapped workspace file
+	struct Matrix *parent; // Set for views, data points into the parent's buffer
+	unsigned int views; // Number of live views into this matrix
+	bool released; // Destroyed while views were live, freed with the last view
+	bool synced; // File named after the matrix matched the buffer when last written
+	Matrix_File_Id_t synced_file; // That file right after the write, valid while synced
+	unsigned char *dirty_tiles; // One bit per tile changed since the last write
+	struct Packed_Matrix *packed; // Set while the elements are held bit-packed, data is NULL then
+	struct Share_Map *share; // Set when data lives in a shared memory segment
+	bool read_only; // Attached from another process, never written here
 }Matrix_t;
 
 bool create_matrix (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols);
+bool create_matrix_for_overwrite (Matrix_t** new_matrix, const char* name, const unsigned int rows, const unsigned int cols);
 void destroy_matrix (Matrix_t** m); 
 bool write_matrix (const char* matrix_output_filename, Matrix_t* m);
+bool update_matrix_file (const char* matrix_output_filename, Matrix_t* m, unsigned int* tiles_written);
 bool read_matrix (const char* matrix_input_filename, Matrix_t** m);
 int sum_matrix (Matrix_t* m);
 bool add_matrices (Matrix_t* a, Matrix_t* b, Matrix_t* c); 
@@ -21,7 +53,15 @@ bool duplicate_matrix (Matrix_t* src, Matrix_t* dest);
 bool equal_matrices (Matrix_t* a, Matrix_t* b); 
 void display_matrix (Matrix_t* m); 
 bool random_matrix(Matrix_t* m, unsigned int start_range, unsigned int end_range);
+bool create_view (Matrix_t** view, const char* name, Matrix_t* src, unsigned int row_start,
+			unsigned int row_end, unsigned int col_start, unsigned int col_end);
+bool materialize_matrix (Matrix_t* src, const char* name, Matrix_t** dest);
+const unsigned int* matrix_row (const Matrix_t* m, unsigned int row, unsigned int* scratch);
 unsigned int add_matrix_to_array (Matrix_t** mats, Matrix_t* new_matrix, unsigned int num_mats);
+int find_matrix_given_name (Matrix_t** mats, unsigned int num_mats, const char* target);
+void unsync_namesakes (Matrix_t** mats, unsigned int num_mats, const Matrix_t* written);
+unsigned long matrix_array_generation (void);
+unsigned int matrix_array_oldest (unsigned int num_mats);
 
 
 #endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <endian.h>
+
+#include "matrix.h"
+#include "packed.h"
+#include "pool.h"
+
+/*protected functions*/
+static unsigned int block_width (const unsigned int* data, size_t count, unsigned int* base);
+static void unpack_block (const unsigned char* deltas, unsigned int bits, unsigned int base,
+			size_t start, size_t count, unsigned int* out);
+
+/*
+ * PURPOSE: Replace the data of a matrix by a frame-of-reference, bit-packed
+ *	copy when that is at most 1/PACK_MIN_SAVING of the plain size. Each block
+ *	of PACK_BLOCK_ELEMS elements stores its minimum and the deltas to it in
+ *	just enough bits for the largest delta.
+ * INPUTS:
+ *	m : Pointer to Matrix_t to pack, must own a plain buffer without views
+ * RETURN: True if the matrix is packed afterwards, else false
+ **/
+bool pack_matrix (Matrix_t* m) {
+	// Check parameter
+	if (!m || m->packed) {
+		return m && m->packed;
+	}
+	if (!m->data || m->parent || m->views || m->mapping || m->share || m->stride != m->cols) {
+		return false;
+	}
+
+	const size_t num_elems = (size_t) m->rows * m->cols;
+	const size_t num_blocks = (num_elems + PACK_BLOCK_ELEMS - 1) / PACK_BLOCK_ELEMS;
+
+	/* First pass sizes every block so the buffer is allocated exactly once */
+	size_t payload_bytes = 0;
+	for (size_t b = 0; b < num_blocks; ++b) {
+		const size_t first = b * PACK_BLOCK_ELEMS;
+		const size_t count = (num_elems - first < PACK_BLOCK_ELEMS) ? num_elems - first : PACK_BLOCK_ELEMS;
+		unsigned int base = 0;
+		payload_bytes += (count * block_width(&m->data[first], count, &base) + 7) / 8;
+	}
+	const size_t bytes = sizeof(Packed_Matrix_t) + num_blocks * sizeof(Packed_Block_t)
+		+ payload_bytes + sizeof(uint64_t);
+	if (bytes * PACK_MIN_SAVING > num_elems * sizeof(unsigned int)) {
+		return false;
+	}
+
+	Packed_Matrix_t* p = pool_alloc(bytes, true);
+	if (!p) {
+		return false;
+	}
+	p->num_elems = num_elems;
+	p->num_blocks = num_blocks;
+	p->bytes = bytes;
+	p->blocks = (Packed_Block_t*) (p + 1);
+	p->payload = (unsigned char*) (p->blocks + num_blocks);
+
+	size_t offset = 0;
+	for (size_t b = 0; b < num_blocks; ++b) {
+		const size_t first = b * PACK_BLOCK_ELEMS;
+		const size_t count = (num_elems - first < PACK_BLOCK_ELEMS) ? num_elems - first : PACK_BLOCK_ELEMS;
+		const unsigned int* values = &m->data[first];
+		unsigned int base = 0;
+		const unsigned int bits = block_width(values, count, &base);
+		p->blocks[b].offset = offset;
+		p->blocks[b].base = base;
+		p->blocks[b].bits = bits;
+
+		// OR every delta into the little endian bit stream of the block
+		unsigned char* deltas = &p->payload[offset];
+		for (size_t i = 0, bit = 0; bits && i < count; ++i, bit += bits) {
+			uint64_t word;
+			memcpy(&word, &deltas[bit >> 3], sizeof(word));
+			word = htole64(le64toh(word) | ((uint64_t) (values[i] - base) << (bit & 7)));
+			memcpy(&deltas[bit >> 3], &word, sizeof(word));
+		}
+		offset += (count * bits + 7) / 8;
+	}
+
+	pool_free(m->data);
+	m->data = NULL;
+	m->packed = p;
+	return true;
+}
+
+/*
+ * PURPOSE: Turn a packed matrix back into a plain buffer
+ * INPUTS:
+ *	m : Pointer to Matrix_t to unpack
+ * RETURN: True if the matrix has a plain buffer afterwards, else false
+ **/
+bool unpack_matrix (Matrix_t* m) {
+	// Check parameter
+	if (!m) {
+		return false;
+	}
+	if (!m->packed) {
+		return m->data != NULL;
+	}
+
+	unsigned int* data = pool_alloc(m->packed->num_elems * sizeof(unsigned int), false);
+	if (!data) {
+		return false;
+	}
+	decode_packed_range(m->packed, 0, m->packed->num_elems, data);
+	pool_free(m->packed);
+	m->packed = NULL;
+	m->data = data;
+	return true;
+}
+
+/*
+ * PURPOSE: Give a packed matrix a plain buffer without decoding, for callers
+ *	about to overwrite every element
+ * INPUTS:
+ *	m : Pointer to Matrix_t to unpack
+ * RETURN: True if the matrix has a plain buffer afterwards, else false
+ **/
+bool unpack_matrix_for_overwrite (Matrix_t* m) {
+	// Check parameter
+	if (!m) {
+		return false;
+	}
+	if (!m->packed) {
+		return m->data != NULL;
+	}
+
+	unsigned int* data = pool_alloc(m->packed->num_elems * sizeof(unsigned int), false);
+	if (!data) {
+		return false;
+	}
+	pool_free(m->packed);
+	m->packed = NULL;
+	m->data = data;
+	return true;
+}
+
+/*
+ * PURPOSE: Decode a run of elements of a packed matrix, in row-major order
+ * INPUTS:
+ *	p : Pointer to Packed_Matrix_t to decode from
+ *	first : Index of the first element
+ *	count : Number of elements to decode
+ *	out : Pointer to store count elements in
+ * RETURN: NONE
+ **/
+void decode_packed_range (const Packed_Matrix_t* p, size_t first, size_t count, unsigned int* out) {
+	while (count > 0) {
+		const size_t b = first / PACK_BLOCK_ELEMS;
+		const size_t start = first % PACK_BLOCK_ELEMS;
+		size_t n = PACK_BLOCK_ELEMS - start;
+		if (n > count) {
+			n = count;
+		}
+		const Packed_Block_t* block = &p->blocks[b];
+		unpack_block(&p->payload[block->offset], block->bits, block->base, start, n, out);
+		out += n;
+		first += n;
+		count -= n;
+	}
+}
+
+/*
+ * PURPOSE: Sum a packed matrix block by block, the bases are never expanded
+ * INPUTS:
+ *	p : Pointer to Packed_Matrix_t to sum
+ * RETURN: Sum of all elements, wrapping like the unsigned elements do
+ **/
+unsigned int sum_packed (const Packed_Matrix_t* p) {
+	unsigned int sum = 0;
+	unsigned int deltas[PACK_BLOCK_ELEMS];
+	for (size_t b = 0; b < p->num_blocks; ++b) {
+		const Packed_Block_t* block = &p->blocks[b];
+		const size_t first = b * PACK_BLOCK_ELEMS;
+		const size_t count = (p->num_elems - first < PACK_BLOCK_ELEMS) ? p->num_elems - first : PACK_BLOCK_ELEMS;
+		sum += block->base * (unsigned int) count;
+		if (block->bits) {
+			unpack_block(&p->payload[block->offset], block->bits, 0, 0, count, deltas);
+			for (size_t i = 0; i < count; ++i) {
+				sum += deltas[i];
+			}
+		}
+	}
+	return sum;
+}
+
+/*
+ * PURPOSE: Compare two packed matrices of the same shape. Packing is
+ *	deterministic, so equal contents always give identical encodings.
+ * INPUTS:
+ *	a : Pointer to first Packed_Matrix_t
+ *	b : Pointer to second Packed_Matrix_t
+ * RETURN: True if both hold the same elements, else false
+ **/
+bool equal_packed (const Packed_Matrix_t* a, const Packed_Matrix_t* b) {
+	if (a->num_elems != b->num_elems || a->bytes != b->bytes) {
+		return false;
+	}
+	const size_t directory = a->num_blocks * sizeof(Packed_Block_t);
+	return memcmp(a->blocks, b->blocks, directory) == 0
+		&& memcmp(a->payload, b->payload, a->bytes - sizeof(Packed_Matrix_t) - directory) == 0;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Find the frame of reference and delta width of one block
+ * INPUTS:
+ *	data : Pointer to the block elements
+ *	count : Number of elements in the block
+ *	base : Pointer to store the smallest element in
+ * RETURN: Bits needed for the largest delta, 0 when all elements are equal
+ **/
+static unsigned int block_width (const unsigned int* data, size_t count, unsigned int* base) {
+	unsigned int min = data[0];
+	unsigned int max = data[0];
+	for (size_t i = 1; i < count; ++i) {
+		min = data[i] < min ? data[i] : min;
+		max = data[i] > max ? data[i] : max;
+	}
+	*base = min;
+	return (max == min) ? 0 : 32 - __builtin_clz(max - min);
+}
+
+/*
+ * PURPOSE: Expand deltas of one block. Each delta is pulled out of a single
+ *	unaligned 64 bit load, so the loop has no branches and no carries
+ *	between words. The memcpy only becomes that load with VECFLAGS.
+ * INPUTS:
+ *	deltas : Pointer to the bit stream of the block
+ *	bits : Width of every delta
+ *	base : Value added to every delta
+ *	start : Index in the block of the first element to expand
+ *	count : Number of elements to expand
+ *	out : Pointer to store count elements in
+ * RETURN: NONE
+ **/
+static void unpack_block (const unsigned char* deltas, unsigned int bits, unsigned int base,
+			size_t start, size_t count, unsigned int* out) {
+	if (bits == 0) {
+		for (size_t i = 0; i < count; ++i) {
+			out[i] = base;
+		}
+		return;
+	}
+
+	const uint64_t mask = (bits == 32) ? 0xFFFFFFFFull : ((1ull << bits) - 1);
+	size_t bit = start * bits;
+	for (size_t i = 0; i < count; ++i, bit += bits) {
+		uint64_t word;
+		memcpy(&word, &deltas[bit >> 3], sizeof(word));
+		out[i] = base + (unsigned int) ((le64toh(word) >> (bit & 7)) & mask);
+	}
+}
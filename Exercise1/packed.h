@@ -0,0 +1,33 @@
+#ifndef _PACKED_H_
+#define _PACKED_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACK_BLOCK_ELEMS 256 // Elements sharing one frame of reference
+#define PACK_MIN_SAVING 2 // Only pack when the packed form is at most half the size
+
+/* One block: every element is base plus a delta of bits width */
+typedef struct {
+	uint64_t offset; // Byte offset of the block deltas in the payload
+	uint32_t base;
+	uint32_t bits;
+}Packed_Block_t;
+
+/* Lives in a single pool buffer: this header, the blocks, then the payload */
+typedef struct Packed_Matrix {
+	size_t num_elems;
+	size_t num_blocks;
+	size_t bytes; // Size of the whole pool buffer
+	Packed_Block_t* blocks;
+	unsigned char* payload; // Padded so every delta can be read with one 64 bit load
+}Packed_Matrix_t;
+
+bool pack_matrix (Matrix_t* m);
+bool unpack_matrix (Matrix_t* m);
+bool unpack_matrix_for_overwrite (Matrix_t* m);
+void decode_packed_range (const Packed_Matrix_t* p, size_t first, size_t count, unsigned int* out);
+unsigned int sum_packed (const Packed_Matrix_t* p);
+bool equal_packed (const Packed_Matrix_t* a, const Packed_Matrix_t* b);
+
+#endif
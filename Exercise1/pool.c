@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "pool.h"
+
+#define POOL_MAGIC_LIVE 0x4C495645u
+#define POOL_MAGIC_FREE 0x46524545u
+
+/* Hidden header in front of every buffer, links it into the live or a free list */
+typedef struct Pool_Block {
+	size_t bytes;
+	struct Pool_Block* prev;
+	struct Pool_Block* next;
+	uint32_t magic;
+	uint32_t size_class;
+}Pool_Block_t;
+
+static Pool_Block_t* live_list = NULL;
+static Pool_Block_t* free_lists[POOL_NUM_CLASSES];
+static Pool_Stats_t stats;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*protected functions*/
+static bool size_class (size_t bytes, uint32_t* class_index, size_t* class_bytes);
+static void unlink_block (Pool_Block_t** list, Pool_Block_t* block);
+static void push_block (Pool_Block_t** list, Pool_Block_t* block);
+
+/*
+ * PURPOSE: Allocate a matrix buffer, reusing a cached buffer of the same size
+ *	class when there is one
+ * INPUTS:
+ *	bytes : Number of bytes needed
+ *	zero : True if the buffer must be zeroed, false when the caller overwrites it
+ * RETURN: Pointer to the buffer, else NULL on failure
+ **/
+void* pool_alloc (size_t bytes, bool zero) {
+	// Check parameter
+	if (bytes == 0) {
+		return NULL;
+	}
+
+	uint32_t class_index = 0;
+	size_t class_bytes = bytes;
+	const bool classed = size_class(bytes, &class_index, &class_bytes);
+
+	pthread_mutex_lock(&pool_lock);
+	Pool_Block_t* block = classed ? free_lists[class_index] : NULL;
+	if (block) {
+		unlink_block(&free_lists[class_index], block);
+		stats.cached_bytes -= block->bytes;
+		stats.cached_buffers--;
+		stats.reused++;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (block) {
+		if (zero) {
+			memset(block + 1, 0, bytes);
+		}
+	}
+	else {
+		// calloc can hand out pages the kernel already zeroed instead of clearing them
+		block = zero ? calloc(1, sizeof(Pool_Block_t) + class_bytes)
+			: malloc(sizeof(Pool_Block_t) + class_bytes);
+		if (!block) {
+			return NULL;
+		}
+		block->bytes = class_bytes;
+		block->size_class = classed ? class_index : POOL_NUM_CLASSES;
+	}
+	block->magic = POOL_MAGIC_LIVE;
+
+	pthread_mutex_lock(&pool_lock);
+	push_block(&live_list, block);
+	stats.allocations++;
+	stats.live_buffers++;
+	stats.live_bytes += block->bytes;
+	if (stats.live_bytes > stats.peak_bytes) {
+		stats.peak_bytes = stats.live_bytes;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	return block + 1;
+}
+
+/*
+ * PURPOSE: Return a buffer from pool_alloc, it is kept for reuse while the
+ *	cache is below POOL_CACHE_LIMIT
+ * INPUTS:
+ *	buffer : Pointer from pool_alloc, may be NULL
+ * RETURN: NONE
+ **/
+void pool_free (void* buffer) {
+	// Check parameter
+	if (!buffer) {
+		return;
+	}
+
+	Pool_Block_t* block = (Pool_Block_t*) buffer - 1;
+	if (block->magic != POOL_MAGIC_LIVE) {
+		fprintf(stderr, "POOL: FREE OF A BUFFER THAT IS NOT LIVE (%p)\n", buffer);
+		return;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	unlink_block(&live_list, block);
+	stats.live_buffers--;
+	stats.live_bytes -= block->bytes;
+
+	const bool cache = block->size_class < POOL_NUM_CLASSES
+		&& stats.cached_bytes + block->bytes <= POOL_CACHE_LIMIT;
+	if (cache) {
+		block->magic = POOL_MAGIC_FREE;
+		push_block(&free_lists[block->size_class], block);
+		stats.cached_bytes += block->bytes;
+		stats.cached_buffers++;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (!cache) {
+		block->magic = 0;
+		free(block);
+	}
+}
+
+/*
+ * PURPOSE: Report the usable size of a buffer from pool_alloc
+ * INPUTS:
+ *	buffer : Pointer from pool_alloc
+ * RETURN: Size in bytes, 0 for NULL
+ **/
+size_t pool_buffer_size (const void* buffer) {
+	if (!buffer) {
+		return 0;
+	}
+	return ((const Pool_Block_t*) buffer - 1)->bytes;
+}
+
+/*
+ * PURPOSE: Copy the current allocation counters
+ * INPUTS:
+ *	out : Pointer to Pool_Stats_t to fill in
+ * RETURN: NONE
+ **/
+void pool_stats (Pool_Stats_t* out) {
+	// Check parameter
+	if (!out) {
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	*out = stats;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * PURPOSE: Give every cached buffer back to the system
+ * INPUTS: NONE
+ * RETURN: NONE
+ **/
+void pool_drain (void) {
+	pthread_mutex_lock(&pool_lock);
+	for (unsigned int i = 0; i < POOL_NUM_CLASSES; ++i) {
+		while (free_lists[i]) {
+			Pool_Block_t* block = free_lists[i];
+			unlink_block(&free_lists[i], block);
+			block->magic = 0;
+			free(block);
+		}
+	}
+	stats.cached_bytes = 0;
+	stats.cached_buffers = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * PURPOSE: Print every buffer that is still live, meant to be called at exit
+ *	once all matrices have been destroyed
+ * INPUTS: NONE
+ * RETURN: Number of leaked buffers
+ **/
+unsigned int pool_report_leaks (void) {
+	pthread_mutex_lock(&pool_lock);
+	for (Pool_Block_t* block = live_list; block; block = block->next) {
+		fprintf(stderr, "POOL: LEAKED %zu BYTES AT %p\n", block->bytes, (void*) (block + 1));
+	}
+	const unsigned int leaks = stats.live_buffers;
+	pthread_mutex_unlock(&pool_lock);
+	return leaks;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Round a request up to its size class. Small buffers step by 64
+ *	bytes, larger ones by an eighth of their power of two, so same shaped
+ *	matrices always share a class and rounding wastes at most 12.5%.
+ * INPUTS:
+ *	bytes : Requested size
+ *	class_index : Pointer to store the free list index in
+ *	class_bytes : Pointer to store the rounded size in
+ * RETURN: True if the size has a class, false if it is too large to cache
+ **/
+static bool size_class (size_t bytes, uint32_t* class_index, size_t* class_bytes) {
+	if (bytes <= POOL_SMALL_LIMIT) {
+		*class_index = (bytes + 63) / 64;
+		*class_bytes = (size_t) *class_index * 64;
+		return true;
+	}
+
+	// bytes lies in (2^power, 2^(power + 1)], split into eight steps
+	const unsigned int power = 63 - __builtin_clzll((unsigned long long) bytes - 1);
+	const size_t step = (size_t) 1 << (power - 3);
+	const size_t rounded = (bytes + step - 1) & ~(step - 1);
+	const uint32_t index = POOL_SMALL_LIMIT / 64 + 1 + (power - 12) * 8 + (uint32_t) (rounded / step) - 9;
+	*class_bytes = rounded;
+	if (index >= POOL_NUM_CLASSES) {
+		return false;
+	}
+	*class_index = index;
+	return true;
+}
+
+/*
+ * PURPOSE: Remove a block from a doubly linked list
+ * INPUTS:
+ *	list : Pointer to the list head
+ *	block : Pointer to Pool_Block_t to remove
+ * RETURN: NONE
+ **/
+static void unlink_block (Pool_Block_t** list, Pool_Block_t* block) {
+	if (block->prev) {
+		block->prev->next = block->next;
+	}
+	else {
+		*list = block->next;
+	}
+	if (block->next) {
+		block->next->prev = block->prev;
+	}
+	block->prev = NULL;
+	block->next = NULL;
+}
+
+/*
+ * PURPOSE: Add a block to the front of a doubly linked list
+ * INPUTS:
+ *	list : Pointer to the list head
+ *	block : Pointer to Pool_Block_t to add
+ * RETURN: NONE
+ **/
+static void push_block (Pool_Block_t** list, Pool_Block_t* block) {
+	block->prev = NULL;
+	block->next = *list;
+	if (*list) {
+		(*list)->prev = block;
+	}
+	*list = block;
+}
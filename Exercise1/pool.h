@@ -0,0 +1,27 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+#define POOL_CACHE_LIMIT (64 << 20) // Most bytes kept in free lists for reuse
+#define POOL_SMALL_LIMIT 4096 // Buffers up to this size are classed in steps of 64 bytes
+#define POOL_NUM_CLASSES 320
+
+typedef struct {
+	size_t live_bytes;
+	size_t peak_bytes;
+	unsigned int live_buffers;
+	size_t cached_bytes;
+	unsigned int cached_buffers;
+	unsigned long allocations;
+	unsigned long reused;
+}Pool_Stats_t;
+
+void* pool_alloc (size_t bytes, bool zero);
+void pool_free (void* buffer);
+size_t pool_buffer_size (const void* buffer);
+void pool_stats (Pool_Stats_t* stats);
+void pool_drain (void);
+unsigned int pool_report_leaks (void);
+
+#endif
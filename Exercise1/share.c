@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "matrix.h"
+#include "share.h"
+#include "workspace.h"
+#include "packed.h"
+#include "pool.h"
+
+/*protected functions*/
+static bool segment_name (const char* name, char* segment);
+
+/*
+ * PURPOSE: Move the buffer of a matrix into a new shared memory segment named
+ *	after it, so other processes can attach it. The matrix keeps working as
+ *	before, every change is published through the segment seqlock.
+ * INPUTS:
+ *	m : Pointer to Matrix_t to share, must own its buffer and have no views
+ * RETURN: True if the matrix is shared, else false
+ **/
+bool share_matrix (Matrix_t* m) {
+	// Check parameters
+	if (!m || !MATRIX_HAS_DATA(m)) {
+		return false;
+	}
+	if (m->parent || m->views || m->share) {
+		printf("ONLY MATRICES WITHOUT VIEWS THAT ARE NOT SHARED YET CAN BE SHARED\n");
+		return false;
+	}
+
+	Share_Map_t* map = calloc(1, sizeof(Share_Map_t));
+	if (!map || !segment_name(m->name, map->segment) || !unpack_matrix(m)) {
+		free(map);
+		return false;
+	}
+
+	const size_t data_bytes = (size_t) m->rows * m->cols * sizeof(unsigned int);
+	int fd = shm_open(map->segment, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		printf("FAILED TO CREATE SHARED SEGMENT (%s)\n", map->segment);
+		if (errno == EEXIST) {
+			perror("SEGMENT EXISTS ALREADY\n");
+		}
+		free(map);
+		return false;
+	}
+	map->length = SHARE_DATA_OFFSET + data_bytes;
+	void* base = MAP_FAILED;
+	if (ftruncate(fd, map->length) == 0) {
+		base = mmap(NULL, map->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("FAILED TO MAP SHARED SEGMENT\n");
+		shm_unlink(map->segment);
+		free(map);
+		return false;
+	}
+
+	map->header = base;
+	map->owner = true;
+	memcpy(map->header->magic, SHARE_MAGIC, sizeof(map->header->magic));
+	map->header->version = SHARE_VERSION;
+	map->header->rows = m->rows;
+	map->header->cols = m->cols;
+	strncpy(map->header->name, m->name, SHARE_NAME_LEN - 1);
+	unsigned int* data = (unsigned int*) ((char*) base + SHARE_DATA_OFFSET);
+	memcpy(data, m->data, data_bytes);
+
+	// The old buffer is no longer needed
+	if (m->mapping) {
+		release_workspace_mapping(m->mapping);
+		m->mapping = NULL;
+	}
+	else {
+		pool_free(m->data);
+	}
+	m->data = data;
+	m->share = map;
+	return true;
+}
+
+/*
+ * PURPOSE: Map a matrix another process shared, read-only and without copying
+ * INPUTS:
+ *	name : Name the matrix was shared under
+ *	m : Pointer to Matrix_t pointer to store the attached matrix in
+ * RETURN: True if the segment was attached, else false
+ **/
+bool attach_matrix (const char* name, Matrix_t** m) {
+	// Check parameters
+	if (!name || !m) {
+		return false;
+	}
+
+	Share_Map_t* map = calloc(1, sizeof(Share_Map_t));
+	if (!map || !segment_name(name, map->segment)) {
+		free(map);
+		return false;
+	}
+
+	int fd = shm_open(map->segment, O_RDONLY, 0);
+	if (fd < 0) {
+		printf("FAILED TO OPEN SHARED SEGMENT (%s)\n", map->segment);
+		free(map);
+		return false;
+	}
+	struct stat st;
+	void* base = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= SHARE_DATA_OFFSET) {
+		map->length = st.st_size;
+		base = mmap(NULL, map->length, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (base == MAP_FAILED) {
+		printf("NOT A SHARED MATRIX (%s)\n", map->segment);
+		free(map);
+		return false;
+	}
+	map->header = base;
+
+	const Share_Header_t* header = map->header;
+	const bool valid = memcmp(header->magic, SHARE_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == SHARE_VERSION
+		&& header->rows != 0 && header->cols != 0
+		&& memchr(header->name, '\0', MATRIX_NAME_LEN) != NULL
+		&& (uint64_t) header->rows * header->cols * sizeof(unsigned int) <= map->length - SHARE_DATA_OFFSET;
+	if (!valid) {
+		printf("NOT A SHARED MATRIX (%s)\n", map->segment);
+		release_share(map);
+		return false;
+	}
+
+	*m = calloc(1, sizeof(Matrix_t));
+	if (!(*m)) {
+		release_share(map);
+		return false;
+	}
+	strncpy((*m)->name, header->name, MATRIX_NAME_LEN);
+	(*m)->rows = header->rows;
+	(*m)->cols = header->cols;
+	(*m)->stride = header->cols;
+	(*m)->data = (unsigned int*) ((char*) base + SHARE_DATA_OFFSET);
+	(*m)->share = map;
+	(*m)->read_only = true;
+	return true;
+}
+
+/*
+ * PURPOSE: Unmap a segment, the owner also removes its name
+ * INPUTS:
+ *	map : Pointer to Share_Map_t to release
+ * RETURN: NONE
+ **/
+void release_share (Share_Map_t* map) {
+	// Check parameter
+	if (!map) {
+		return;
+	}
+	munmap(map->header, map->length);
+	if (map->owner) {
+		shm_unlink(map->segment);
+	}
+	free(map);
+}
+
+/*
+ * PURPOSE: Mark the data of a segment as being written, readers retry
+ * INPUTS:
+ *	map : Pointer to Share_Map_t owned by this process
+ * RETURN: NONE
+ **/
+void share_write_begin (Share_Map_t* map) {
+	__atomic_fetch_add(&map->header->sequence, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * PURPOSE: Publish the data written since share_write_begin
+ * INPUTS:
+ *	map : Pointer to Share_Map_t owned by this process
+ * RETURN: NONE
+ **/
+void share_write_end (Share_Map_t* map) {
+	__atomic_fetch_add(&map->header->sequence, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * PURPOSE: Start a read of a shared segment
+ * INPUTS:
+ *	header : Pointer to the mapped Share_Header_t
+ * RETURN: Sequence to pass to share_read_retry once the data is copied
+ **/
+uint32_t share_read_begin (const Share_Header_t* header) {
+	return __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * PURPOSE: Check whether data copied since share_read_begin may be torn
+ * INPUTS:
+ *	header : Pointer to the mapped Share_Header_t
+ *	sequence : Value returned by share_read_begin
+ * RETURN: True if the copy has to be redone, false if it is consistent
+ **/
+bool share_read_retry (const Share_Header_t* header, uint32_t sequence) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (sequence & 1) || __atomic_load_n(&header->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Build the shared memory object name of a matrix
+ * INPUTS:
+ *	name : Name of the matrix
+ *	segment : Pointer to room for SHARE_NAME_LEN + sizeof(SHARE_PREFIX) characters
+ * RETURN: True if the matrix name can be used for a segment, else false
+ **/
+static bool segment_name (const char* name, char* segment) {
+	if (strlen(name) + 1 > MATRIX_NAME_LEN || strchr(name, '/')) {
+		printf("Matrix name (%s) can not be used for a shared segment\n", name);
+		return false;
+	}
+	snprintf(segment, SHARE_NAME_LEN + sizeof(SHARE_PREFIX), "%s%s", SHARE_PREFIX, name);
+	return true;
+}
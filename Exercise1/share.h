@@ -0,0 +1,49 @@
+#ifndef _SHARE_H_
+#define _SHARE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHARE_MAGIC "MSHM"
+#define SHARE_VERSION 1
+#define SHARE_PREFIX "/matlab." // Segment of matrix A is /dev/shm/matlab.A
+#define SHARE_NAME_LEN 32
+#define SHARE_DATA_OFFSET 64 // Matrix data starts one cache line into the segment
+#define SHARE_MAX_RETRIES 1000 // Reads given up after this many collisions with the writer
+
+/*
+ * Layout of a shared segment: this header, then rows * cols elements at
+ * SHARE_DATA_OFFSET. sequence is a seqlock, odd while the owner is writing,
+ * readers copy the data and retry when it was odd or has changed.
+ **/
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t sequence;
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t reserved;
+	char name[SHARE_NAME_LEN];
+}Share_Header_t;
+
+/* A mapped segment, shared by its owner or attached read-only */
+typedef struct Share_Map {
+	Share_Header_t *header;
+	size_t length;
+	bool owner; // Created the segment, unlinks it when done
+	char segment[SHARE_NAME_LEN + sizeof(SHARE_PREFIX)];
+}Share_Map_t;
+
+bool share_matrix (Matrix_t* m);
+bool attach_matrix (const char* name, Matrix_t** m);
+void release_share (Share_Map_t* map);
+
+/* Writer side of the seqlock, used by the matrix kernels */
+void share_write_begin (Share_Map_t* map);
+void share_write_end (Share_Map_t* map);
+
+/* Reader side of the seqlock, enough for another program to read a segment */
+uint32_t share_read_begin (const Share_Header_t* header);
+bool share_read_retry (const Share_Header_t* header, uint32_t sequence);
+
+#endif
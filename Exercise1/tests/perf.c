@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <time.h>
+
+#include "../matrix.h"
+#include "../packed.h"
+#include "../pool.h"
+#include "../convolve.h"
+
+#define PERF_ROWS 2048 // Reference size every operation is timed on
+#define PERF_COLS 2048
+#define PERF_REPEATS 5 // Best of this many runs counts, to ride out noise
+
+/* Matrices every case works on, filled once */
+typedef struct {
+	Matrix_t* wide; // Values over the whole range, never packed
+	Matrix_t* other;
+	Matrix_t* narrow; // Values 10..15, bit-packed
+	Matrix_t* dest;
+	Matrix_t* box; // 3x3 of ones, separable
+	Matrix_t* laplace; // 3x3 with -1 entries, not separable
+}Perf_Data_t;
+
+/*
+ * One timed operation and the slowest it may run, in million elements per
+ * second on the reference size. Budgets are a quarter or less of what an
+ * unoptimized build (the Makefile CFLAGS) does on one core, so only a real
+ * regression trips them. A case that needs particular contents in dest sets
+ * them up in prepare, untimed before every run, so no case depends on
+ * another having run first.
+ **/
+typedef struct {
+	const char* name;
+	bool (*prepare)(Perf_Data_t* data);
+	bool (*run)(Perf_Data_t* data);
+	double budget;
+}Perf_Case_t;
+
+/*protected functions*/
+static bool run_add (Perf_Data_t* data);
+static bool run_sum (Perf_Data_t* data);
+static bool run_sum_packed (Perf_Data_t* data);
+static bool run_shift (Perf_Data_t* data);
+static bool run_duplicate (Perf_Data_t* data);
+static bool run_equal (Perf_Data_t* data);
+static bool run_random (Perf_Data_t* data);
+static bool run_convolve_box (Perf_Data_t* data);
+static bool run_convolve_laplace (Perf_Data_t* data);
+static bool copy_wide_to_dest (Perf_Data_t* data);
+static bool convolve_into_dest (Perf_Data_t* data, Matrix_t* kernel);
+static const Perf_Case_t* find_case (const char* name);
+static bool setup_data (Perf_Data_t* data);
+static void destroy_data (Perf_Data_t* data);
+static double now_seconds (void);
+
+static const Perf_Case_t perf_cases[] = {
+	{"add", NULL, run_add, 90},
+	{"sum", NULL, run_sum, 75},
+	{"sum packed", NULL, run_sum_packed, 30},
+	{"shift", copy_wide_to_dest, run_shift, 90},
+	{"duplicate", NULL, run_duplicate, 170},
+	{"equal", copy_wide_to_dest, run_equal, 350},
+	{"random", NULL, run_random, 8},
+	{"convolve 3x3 box", NULL, run_convolve_box, 15},
+	{"convolve 3x3 laplace", NULL, run_convolve_laplace, 15},
+};
+
+/*
+ * PURPOSE: Time every case on the reference size and compare it with its budget
+ * INPUTS:
+ *	argc : Number of arguments
+ *	argv : Names of the cases to run in that order, every case when there are none
+ * RETURN: 0 if every case run is within budget, else 1
+ **/
+int main (int argc, char** argv) {
+	Perf_Data_t data;
+	if (!setup_data(&data)) {
+		printf("FAILED TO SET UP PERF DATA\n");
+		destroy_data(&data);
+		return 1;
+	}
+
+	const double elements = (double) PERF_ROWS * PERF_COLS;
+	int status = 0;
+	const unsigned int num_cases = sizeof(perf_cases) / sizeof(perf_cases[0]);
+	const unsigned int num_runs = argc > 1 ? (unsigned int) argc - 1 : num_cases;
+	for (unsigned int i = 0; i < num_runs; ++i) {
+		const Perf_Case_t* c = argc > 1 ? find_case(argv[i + 1]) : &perf_cases[i];
+		if (!c) {
+			printf("FAIL %-22s no such case\n", argv[i + 1]);
+			status = 1;
+			continue;
+		}
+		double best = 0;
+		for (unsigned int r = 0; r < PERF_REPEATS; ++r) {
+			if (c->prepare && !c->prepare(&data)) {
+				printf("FAIL %-22s setup failed\n", c->name);
+				status = 1;
+				break;
+			}
+			const double start = now_seconds();
+			if (!c->run(&data)) {
+				printf("FAIL %-22s operation failed\n", c->name);
+				status = 1;
+				break;
+			}
+			const double elapsed = now_seconds() - start;
+			if (r == 0 || elapsed < best) {
+				best = elapsed;
+			}
+		}
+		const double rate = best > 0 ? elements / best / 1e6 : elements;
+		const bool within = rate >= c->budget;
+		printf("%s %-22s %10.1f M elements/s (budget %.0f)\n", within ? "PASS" : "FAIL", c->name, rate,
+			c->budget);
+		if (!within) {
+			status = 1;
+		}
+	}
+
+	destroy_data(&data);
+	pool_drain();
+	return status;
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Add the two wide matrices into dest
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the addition succeeded, else false
+ **/
+static bool run_add (Perf_Data_t* data) {
+	return add_matrices(data->wide, data->other, data->dest);
+}
+
+/*
+ * PURPOSE: Sum the plain wide matrix
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True
+ **/
+static bool run_sum (Perf_Data_t* data) {
+	// Keep the result alive so the loop is not optimized away
+	volatile unsigned int sum = sum_matrix(data->wide);
+	(void) sum;
+	return true;
+}
+
+/*
+ * PURPOSE: Sum the narrow matrix straight from its packed blocks
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if narrow is still packed, else false
+ **/
+static bool run_sum_packed (Perf_Data_t* data) {
+	volatile unsigned int sum = sum_matrix(data->narrow);
+	(void) sum;
+	return data->narrow->packed != NULL;
+}
+
+/*
+ * PURPOSE: Shift dest, a copy of wide, left by one bit
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the shift succeeded, else false
+ **/
+static bool run_shift (Perf_Data_t* data) {
+	return bitwise_shift_matrix(data->dest, 'l', 1);
+}
+
+/*
+ * PURPOSE: Copy wide into dest
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the copy succeeded, else false
+ **/
+static bool run_duplicate (Perf_Data_t* data) {
+	return duplicate_matrix(data->wide, data->dest);
+}
+
+/*
+ * PURPOSE: Compare wide with dest, a copy of it, so every element is compared
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the matrices compared equal, else false
+ **/
+static bool run_equal (Perf_Data_t* data) {
+	return equal_matrices(data->wide, data->dest);
+}
+
+/*
+ * PURPOSE: Fill dest with random values over the whole range
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the fill succeeded, else false
+ **/
+static bool run_random (Perf_Data_t* data) {
+	return random_matrix(data->dest, 0, 4000000000u);
+}
+
+/*
+ * PURPOSE: Convolve wide with the separable 3x3 box kernel
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the convolution succeeded, else false
+ **/
+static bool run_convolve_box (Perf_Data_t* data) {
+	return convolve_into_dest(data, data->box);
+}
+
+/*
+ * PURPOSE: Convolve wide with the non separable 3x3 laplace kernel
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the convolution succeeded, else false
+ **/
+static bool run_convolve_laplace (Perf_Data_t* data) {
+	return convolve_into_dest(data, data->laplace);
+}
+
+/*
+ * PURPOSE: Make dest a copy of wide
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: True if the copy succeeded, else false
+ **/
+static bool copy_wide_to_dest (Perf_Data_t* data) {
+	return duplicate_matrix(data->wide, data->dest);
+}
+
+/*
+ * PURPOSE: Convolve the wide matrix, replacing dest with the result
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ *	kernel : Pointer to the kernel Matrix_t
+ * RETURN: True if the convolution succeeded, else false
+ **/
+static bool convolve_into_dest (Perf_Data_t* data, Matrix_t* kernel) {
+	Matrix_t* result = NULL;
+	if (!convolve_matrix(data->wide, kernel, BORDER_CLAMP, "result", &result)) {
+		return false;
+	}
+	destroy_matrix(&data->dest);
+	data->dest = result;
+	return true;
+}
+
+/*
+ * PURPOSE: Look up a case by name
+ * INPUTS:
+ *	name : Name of the case
+ * RETURN: Pointer to the Perf_Case_t, else NULL if there is no such case
+ **/
+static const Perf_Case_t* find_case (const char* name) {
+	for (unsigned int i = 0; i < sizeof(perf_cases) / sizeof(perf_cases[0]); ++i) {
+		if (strcmp(perf_cases[i].name, name) == 0) {
+			return &perf_cases[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * PURPOSE: Create and fill the matrices of every case with a fixed seed
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t to fill, unset matrices stay NULL
+ * RETURN: True if every matrix was created, else false
+ **/
+static bool setup_data (Perf_Data_t* data) {
+	memset(data, 0, sizeof(Perf_Data_t));
+	srand(2015);
+	if (!create_matrix(&data->wide, "wide", PERF_ROWS, PERF_COLS)
+		|| !create_matrix(&data->other, "other", PERF_ROWS, PERF_COLS)
+		|| !create_matrix(&data->narrow, "narrow", PERF_ROWS, PERF_COLS)
+		|| !create_matrix(&data->dest, "dest", PERF_ROWS, PERF_COLS)
+		|| !create_matrix(&data->box, "box", 3, 3)
+		|| !create_matrix(&data->laplace, "laplace", 3, 3)) {
+		return false;
+	}
+	if (!random_matrix(data->wide, 0, 4000000000u) || !random_matrix(data->other, 0, 4000000000u)
+		|| !random_matrix(data->narrow, 10, 15)) {
+		return false;
+	}
+	const unsigned int box[9] = {1, 1, 1, 1, 1, 1, 1, 1, 1};
+	const unsigned int laplace[9] = {0, -1u, 0, -1u, 4, -1u, 0, -1u, 0};
+	memcpy(data->box->data, box, sizeof(box));
+	memcpy(data->laplace->data, laplace, sizeof(laplace));
+	return true;
+}
+
+/*
+ * PURPOSE: Free every matrix of the cases
+ * INPUTS:
+ *	data : Pointer to Perf_Data_t
+ * RETURN: NONE
+ **/
+static void destroy_data (Perf_Data_t* data) {
+	destroy_matrix(&data->wide);
+	destroy_matrix(&data->other);
+	destroy_matrix(&data->narrow);
+	destroy_matrix(&data->dest);
+	destroy_matrix(&data->box);
+	destroy_matrix(&data->laplace);
+}
+
+/*
+ * PURPOSE: Read a monotonic clock
+ * INPUTS: NONE
+ * RETURN: Seconds since an arbitrary start
+ **/
+static double now_seconds (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
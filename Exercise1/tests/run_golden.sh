@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Runs every tests/<name>.cmds through ./matlab in an empty scratch directory
+# (with tests/data linked in as data/) and compares what it leaves behind
+# byte for byte with tests/golden/<name>/: every matrix file it wrote plus the
+# sum and equal lines it printed, collected in a file called results.
+# temp_mat is left out, it is random.
+#
+# sh tests/run_golden.sh --update rewrites the golden files from the current build.
+# The random goldens assume the glibc rand().
+#
+
+tests=$(cd "$(dirname "$0")" && pwd)
+matlab="$tests/../matlab"
+update=0
+if [ "$1" = "--update" ]; then
+	update=1
+fi
+
+failed=0
+for script in "$tests"/*.cmds; do
+	name=$(basename "$script" .cmds)
+	scratch=$(mktemp -d)
+	mkdir "$scratch/run"
+	ln -s "$tests/data" "$scratch/run/data"
+
+	(cd "$scratch/run" && "$matlab" < "$script" > "$scratch/transcript" 2> "$scratch/errors")
+	status=$?
+	grep -E '^(Sum of|  |SAME DATA|DIFFERENT DATA)' "$scratch/transcript" > "$scratch/run/results"
+	rm -f "$scratch/run/data" "$scratch/run/temp_mat"
+
+	if [ $status -ne 0 ] || grep -q -E 'Failed|FAILED|doesn.t exist' "$scratch/transcript" \
+		|| [ -s "$scratch/errors" ]; then
+		echo "FAIL $name: command failed"
+		tail -n 20 "$scratch/transcript" "$scratch/errors"
+		failed=1
+	elif [ $update -eq 1 ]; then
+		rm -rf "$tests/golden/$name"
+		mkdir -p "$tests/golden"
+		cp -R "$scratch/run" "$tests/golden/$name"
+		echo "UPDATED $name"
+	elif diff -r "$tests/golden/$name" "$scratch/run"; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name: output differs from tests/golden/$name"
+		failed=1
+	fi
+	rm -rf "$scratch"
+done
+exit $failed
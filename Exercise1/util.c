@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "util.h"
+
+/*
+ * PURPOSE: Pick how many threads to split some work over, never more than
+ *	there are processors online
+ * INPUTS:
+ *	work : Amount of work, in any unit
+ *	min_work : Least work worth a thread of its own, in the same unit
+ *	max_threads : Most threads the caller has room for
+ * RETURN: Number of threads, at least one
+ **/
+unsigned int count_threads (size_t work, size_t min_work, unsigned int max_threads) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t threads = min_work ? work / min_work : work;
+	if (cpus > 0 && threads > (size_t) cpus) {
+		threads = cpus;
+	}
+	if (threads > max_threads) {
+		threads = max_threads;
+	}
+	if (threads > UTIL_MAX_THREADS) {
+		threads = UTIL_MAX_THREADS;
+	}
+	return threads ? threads : 1;
+}
+
+/*
+ * PURPOSE: Run a function over every item of an array, one thread per item,
+ *	and wait for all of them
+ * INPUTS:
+ *	items : Pointer to the first item
+ *	item_size : Size of one item in bytes
+ *	num_items : Number of items
+ *	work : Function to run on each item
+ * RETURN: NONE
+ **/
+void run_parallel (void* items, size_t item_size, unsigned int num_items, void* (*work)(void*)) {
+	pthread_t threads[UTIL_MAX_THREADS];
+	bool started[UTIL_MAX_THREADS] = {false};
+	char* item = items;
+
+	// The calling thread takes the first item itself, and any item no thread could be started for
+	for (unsigned int i = 1; i < num_items; ++i) {
+		item += item_size;
+		if (i < UTIL_MAX_THREADS) {
+			started[i] = pthread_create(&threads[i], NULL, work, item) == 0;
+		}
+		if (i >= UTIL_MAX_THREADS || !started[i]) {
+			work(item);
+		}
+	}
+	work(items);
+	for (unsigned int i = 1; i < num_items && i < UTIL_MAX_THREADS; ++i) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+}
+
+/*
+ * PURPOSE: Write a whole buffer, retrying short writes
+ * INPUTS:
+ *	fd : File descriptor to write to
+ *	buffer : Pointer to the bytes to write
+ *	length : Number of bytes to write
+ *	offset : File offset to start writing at, negative for the current file position
+ * RETURN: True if everything was written, else false
+ **/
+bool write_fully (int fd, const void* buffer, size_t length, off_t offset) {
+	const char* bytes = buffer;
+	while (length > 0) {
+		const ssize_t written = (offset < 0) ? write(fd, bytes, length) : pwrite(fd, bytes, length, offset);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		bytes += written;
+		length -= written;
+		if (offset >= 0) {
+			offset += written;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,14 @@
+#ifndef _UTIL_H_
+#define _UTIL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define UTIL_MAX_THREADS 16 // Most threads run_parallel starts at once
+
+unsigned int count_threads (size_t work, size_t min_work, unsigned int max_threads);
+void run_parallel (void* items, size_t item_size, unsigned int num_items, void* (*work)(void*));
+bool write_fully (int fd, const void* buffer, size_t length, off_t offset);
+
+#endif
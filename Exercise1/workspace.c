@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "matrix.h"
+#include "workspace.h"
+#include "util.h"
+
+/*protected functions*/
+static uint64_t align_offset (uint64_t offset);
+
+/*
+ * PURPOSE: Write every matrix in the array into a single indexed workspace file.
+ *	Matrices are stored oldest first, so loading the file back fills the array
+ *	in the same order and later additions evict the same matrices as before.
+ * INPUTS:
+ *	workspace_filename : filename to write the workspace to
+ *	mats : Pointer to Matrix_t array to save
+ *	num_mats : Number of matrices in mats array
+ *	journal_epoch : Epoch of the journal continuing from this workspace, 0 if none
+ * RETURN: True if every matrix was written, else false
+ **/
+bool save_workspace (const char* workspace_filename, Matrix_t** mats, unsigned int num_mats,
+			uint32_t journal_epoch) {
+	// Check parameters
+	if(!workspace_filename || !mats) {
+		return false;
+	}
+
+	Workspace_Header_t header;
+	memset(&header, 0, sizeof(Workspace_Header_t));
+	memcpy(header.magic, WORKSPACE_MAGIC, sizeof(header.magic));
+	header.version = WORKSPACE_VERSION;
+	header.journal_epoch = journal_epoch;
+	for (unsigned int i = 0; i < num_mats; ++i) {
+		if (mats[i] && MATRIX_HAS_DATA(mats[i])) {
+			header.count++;
+		}
+	}
+	const unsigned int oldest = matrix_array_oldest(num_mats);
+
+	Workspace_Entry_t* table = calloc(header.count ? header.count : 1, sizeof(Workspace_Entry_t));
+	if (!table) {
+		return false;
+	}
+
+	/* Build the offset table, data blocks start after the table */
+	uint64_t offset = align_offset(sizeof(Workspace_Header_t) + header.count * sizeof(Workspace_Entry_t));
+	unsigned int entry = 0;
+	for (unsigned int k = 0; k < num_mats; ++k) {
+		const Matrix_t* m = mats[(oldest + k) % num_mats];
+		if (!m || !MATRIX_HAS_DATA(m)) {
+			continue;
+		}
+		strncpy(table[entry].name, m->name, WORKSPACE_ENTRY_NAME_LEN - 1);
+		table[entry].rows = m->rows;
+		table[entry].cols = m->cols;
+		table[entry].offset = offset;
+		offset = align_offset(offset + (uint64_t) m->rows * m->cols * sizeof(unsigned int));
+		entry++;
+	}
+
+	/*
+	 * Write into a temporary file and rename it over the target so matrices
+	 * still mapped from an older copy of the workspace keep their pages
+	 */
+	size_t tmp_len = strlen(workspace_filename) + strlen(".tmp") + 1;
+	char* tmp_filename = calloc(tmp_len, sizeof(char));
+	if (!tmp_filename) {
+		free(table);
+		return false;
+	}
+	snprintf(tmp_filename, tmp_len, "%s.tmp", workspace_filename);
+
+	int fd = open(tmp_filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("FAILED TO CREATE/OPEN WORKSPACE FILE FOR WRITING\n");
+		if (errno == EACCES) {
+			perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		free(tmp_filename);
+		free(table);
+		return false;
+	}
+
+	bool success = write_fully(fd, &header, sizeof(Workspace_Header_t), 0)
+		&& write_fully(fd, table, header.count * sizeof(Workspace_Entry_t), sizeof(Workspace_Header_t))
+		&& ftruncate(fd, offset) == 0;
+
+	entry = 0;
+	for (unsigned int k = 0; success && k < num_mats; ++k) {
+		const Matrix_t* m = mats[(oldest + k) % num_mats];
+		if (!m || !MATRIX_HAS_DATA(m)) {
+			continue;
+		}
+		if (!m->packed && m->stride == m->cols) {
+			success = write_fully(fd, m->data,
+				(size_t) m->rows * m->cols * sizeof(unsigned int), table[entry].offset);
+		}
+		else {
+			// Views and packed matrices are saved one plain row at a time
+			const size_t row_bytes = (size_t) m->cols * sizeof(unsigned int);
+			unsigned int* scratch = m->packed ? malloc(row_bytes) : NULL;
+			success = !m->packed || scratch;
+			for (unsigned int r = 0; success && r < m->rows; ++r) {
+				success = write_fully(fd, matrix_row(m, r, scratch), row_bytes,
+					table[entry].offset + r * row_bytes);
+			}
+			free(scratch);
+		}
+		entry++;
+	}
+
+	if (success && fsync(fd)) {
+		success = false;
+	}
+	if (close(fd)) {
+		success = false;
+	}
+	if (success && rename(tmp_filename, workspace_filename)) {
+		success = false;
+	}
+	if (!success) {
+		printf("FAILED TO WRITE WORKSPACE FILE\n");
+		unlink(tmp_filename);
+	}
+
+	free(tmp_filename);
+	free(table);
+	return success;
+}
+
+/*
+ * PURPOSE: Read the journal epoch stored in a workspace file header
+ * INPUTS:
+ *	workspace_filename : filename of the workspace
+ *	journal_epoch : Pointer to store the epoch in
+ * RETURN: True if the file has a valid workspace header, else false
+ **/
+bool read_workspace_journal_epoch (const char* workspace_filename, uint32_t* journal_epoch) {
+	// Check parameters
+	if (!workspace_filename || !journal_epoch) {
+		return false;
+	}
+
+	int fd = open(workspace_filename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	Workspace_Header_t header;
+	const bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header)
+		&& memcmp(header.magic, WORKSPACE_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == WORKSPACE_VERSION;
+	close(fd);
+	if (valid) {
+		*journal_epoch = header.journal_epoch;
+	}
+	return valid;
+}
+
+/*
+ * PURPOSE: Map a workspace file and add each matrix in it to the array. Matrix
+ *	data is not copied, it points into a private mapping of the file so pages
+ *	are only read in when touched and modifications never reach the file.
+ * INPUTS:
+ *	workspace_filename : filename to load the workspace from
+ *	mats : Pointer to Matrix_t array to add the matrices to
+ *	num_mats : Number of matrices in mats array, files holding more are refused
+ *	loaded : Pointer to store the number of loaded matrices in, may be NULL
+ * RETURN: True if the workspace was loaded, else false
+ **/
+bool load_workspace (const char* workspace_filename, Matrix_t** mats, unsigned int num_mats,
+			unsigned int* loaded) {
+	// Check parameters
+	if(!workspace_filename || !mats) {
+		return false;
+	}
+	if (loaded) {
+		*loaded = 0;
+	}
+
+	int fd = open(workspace_filename, O_RDONLY);
+	if (fd < 0) {
+		printf("FAILED TO OPEN WORKSPACE FOR READING\n");
+		if (errno == EACCES) {
+			perror("DO NOT HAVE ACCESS TO FILE\n");
+		}
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(Workspace_Header_t)) {
+		printf("NOT A WORKSPACE FILE\n");
+		close(fd);
+		return false;
+	}
+
+	const size_t length = st.st_size;
+	void* base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("FAILED TO MAP WORKSPACE FILE\n");
+		return false;
+	}
+
+	/* Validate the header and the whole offset table before creating anything */
+	const Workspace_Header_t* header = base;
+	const Workspace_Entry_t* table = (const Workspace_Entry_t*) ((const char*) base + sizeof(Workspace_Header_t));
+	bool valid = memcmp(header->magic, WORKSPACE_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == WORKSPACE_VERSION
+		&& (length - sizeof(Workspace_Header_t)) / sizeof(Workspace_Entry_t) >= header->count;
+	for (uint32_t i = 0; valid && i < header->count; ++i) {
+		const uint64_t bytes = (uint64_t) table[i].rows * table[i].cols * sizeof(unsigned int);
+		valid = table[i].rows != 0 && table[i].cols != 0
+			&& memchr(table[i].name, '\0', MATRIX_NAME_LEN) != NULL
+			&& table[i].offset % sizeof(unsigned int) == 0
+			&& table[i].offset <= length && bytes <= length - table[i].offset;
+	}
+	if (!valid) {
+		printf("NOT A WORKSPACE FILE\n");
+		munmap(base, length);
+		return false;
+	}
+	/* Loading more than the array holds would silently evict matrices of the same file */
+	if (header->count > num_mats) {
+		printf("WORKSPACE HOLDS %u MATRICES, ONLY %u FIT\n", header->count, num_mats);
+		munmap(base, length);
+		return false;
+	}
+
+	Workspace_Map_t* map = calloc(1, sizeof(Workspace_Map_t));
+	if (!map) {
+		munmap(base, length);
+		return false;
+	}
+	map->base = base;
+	map->length = length;
+	/* Hold a reference while matrices are added so an early eviction can not unmap */
+	map->refs = 1;
+
+	bool success = true;
+	for (uint32_t i = 0; i < header->count; ++i) {
+		Matrix_t* m = calloc(1, sizeof(Matrix_t));
+		if (!m) {
+			success = false;
+			break;
+		}
+		strncpy(m->name, table[i].name, MATRIX_NAME_LEN);
+		m->rows = table[i].rows;
+		m->cols = table[i].cols;
+		m->stride = table[i].cols;
+		m->data = (unsigned int*) ((char*) base + table[i].offset);
+		m->mapping = map;
+		map->refs++;
+
+		if (0 > add_matrix_to_array(mats, m, num_mats)) {
+			destroy_matrix(&m);
+			success = false;
+			break;
+		}
+		if (loaded) {
+			(*loaded)++;
+		}
+	}
+
+	release_workspace_mapping(map);
+	return success;
+}
+
+/*
+ * PURPOSE: Drop a reference to a workspace mapping, unmapping it with the last one
+ * INPUTS:
+ *	map : Pointer to Workspace_Map_t to release
+ * RETURN: NONE
+ **/
+void release_workspace_mapping (Workspace_Map_t* map) {
+	// Check parameter
+	if (!map) {
+		return;
+	}
+	if (--map->refs == 0) {
+		munmap(map->base, map->length);
+		free(map);
+	}
+}
+
+/*Protected Functions in C*/
+
+/*
+ * PURPOSE: Round a file offset up to the workspace data alignment
+ * INPUTS:
+ *	offset : Offset to round up
+ * RETURN: The aligned offset
+ **/
+static uint64_t align_offset (uint64_t offset) {
+	return (offset + WORKSPACE_DATA_ALIGN - 1) & ~((uint64_t) WORKSPACE_DATA_ALIGN - 1);
+}
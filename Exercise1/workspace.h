@@ -0,0 +1,45 @@
+#ifndef _WORKSPACE_H_
+#define _WORKSPACE_H_
+
+#include <stdint.h>
+
+#define WORKSPACE_MAGIC "MWSP"
+#define WORKSPACE_VERSION 1
+#define WORKSPACE_ENTRY_NAME_LEN 32
+#define WORKSPACE_DATA_ALIGN 64
+
+/*
+ * On disk layout of a workspace file:
+ *	Workspace_Header_t
+ *	Workspace_Entry_t[count]	(offset table)
+ *	matrix data, each block aligned to WORKSPACE_DATA_ALIGN bytes
+ **/
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t journal_epoch; // Epoch of the journal continuing from this workspace, 0 if none
+}Workspace_Header_t;
+
+typedef struct {
+	char name[WORKSPACE_ENTRY_NAME_LEN];
+	uint32_t rows;
+	uint32_t cols;
+	uint64_t offset;
+}Workspace_Entry_t;
+
+/* Shared mapping of a loaded workspace file, released when its last matrix is destroyed */
+typedef struct Workspace_Map {
+	void *base;
+	size_t length;
+	unsigned int refs;
+}Workspace_Map_t;
+
+bool save_workspace (const char* workspace_filename, Matrix_t** mats, unsigned int num_mats,
+			uint32_t journal_epoch);
+bool read_workspace_journal_epoch (const char* workspace_filename, uint32_t* journal_epoch);
+bool load_workspace (const char* workspace_filename, Matrix_t** mats, unsigned int num_mats,
+			unsigned int* loaded);
+void release_workspace_mapping (Workspace_Map_t* map);
+
+#endif